@@ -71,13 +71,19 @@ static int elf_check(struct elf_header *header)
     return 0;
 }
 
+// ロードするセグメントの最大数
+#define ELF_LOAD_SEGMENT_NUM 4
+
 // ELF形式のセグメント情報を解析する
+// 受信バッファはロード先のRAMと重なっているので、セグメントはその場で前に詰めてコピーする
+// そのため、ロード先が読み込み元より後ろになるセグメントや、アドレス順に並んでいないものは扱えない
 static int elf_load_program(struct elf_header *header)
 {
-    int i;
+    int i, num = 0;
     struct elf_program_header *pheader;
+    struct elf_program_header segments[ELF_LOAD_SEGMENT_NUM];
 
-    // セグメント単位でループ
+    // コピーするとバッファ上のプログラムヘッダが上書きされうるので、先に退避しておく
     for (i = 0; i < header->program_header_num; i++) {
         // プログラムヘッダを取得
         pheader = (struct elf_program_header *)((char *)header + header->program_header_offset + header->program_header_size * i);
@@ -85,9 +91,26 @@ static int elf_load_program(struct elf_header *header)
         if (pheader->type != 1) {
             continue;
         }
-        // セグメント情報を参照してロード作業を行う
-        memcpy((char *)pheader->physical_addr, (char *)header + pheader->offset, pheader->file_size);
-        memset((char *)pheader->physical_addr + pheader->file_size, 0, pheader->memory_size - pheader->file_size);
+        if (num == ELF_LOAD_SEGMENT_NUM) {
+            return -1;
+        }
+        // 前から順にコピーしても読み込み元を壊さないかチェック
+        if ((char *)pheader->physical_addr > (char *)header + pheader->offset) {
+            return -1;
+        }
+        if ((num > 0) && (pheader->physical_addr < segments[num - 1].physical_addr + segments[num - 1].memory_size)) {
+            return -1;
+        }
+        memcpy(&segments[num++], pheader, sizeof(*pheader));
+    }
+    // セグメント情報を参照してロード作業を行う
+    for (i = 0; i < num; i++) {
+        memcpy((char *)segments[i].physical_addr, (char *)header + segments[i].offset, segments[i].file_size);
+    }
+    // ゼロクリアは後続のセグメントの読み込み元を壊さないよう、すべてコピーしてから行う
+    for (i = 0; i < num; i++) {
+        memset((char *)segments[i].physical_addr + segments[i].file_size, 0,
+               segments[i].memory_size - segments[i].file_size);
     }
     return 0;
 }
@@ -95,13 +118,17 @@ static int elf_load_program(struct elf_header *header)
 char *elf_load(char *buf)
 {
     struct elf_header *header = (struct elf_header *)buf;
+    char *entry_point;
+
     if (elf_check(header) < 0) {
         return NULL;
     }
+    // ロードするとELFヘッダが上書きされうるので、エントリポイントを先に取り出す
+    entry_point = (char *)header->entry_point;
     if (elf_load_program(header) < 0) {
         return NULL;
     }
     // エントリポイントを返す
-    return (char *)header->entry_point;
+    return entry_point;
 }
 
@@ -61,7 +61,7 @@ int main(void)
     static char buf[16];
     static long size = -1;
     static unsigned char *loadbuf = NULL;
-    extern int buffer_start;
+    extern int buffer_start, buffer_end;
     char *entry_point;
     void (*f)(void);
 
@@ -77,7 +77,7 @@ int main(void)
 
         if (!strcmp(buf, "load")) {
             loadbuf = (char *)(&buffer_start);
-            size = xmodem_recv(loadbuf);
+            size = xmodem_recv(loadbuf, (unsigned char *)(&buffer_end) - loadbuf);
             wait();
             if (size < 0) {
                 puts("\nXMODEM recieve error!\n");
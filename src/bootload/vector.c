@@ -4,13 +4,16 @@ extern void start(void);            // スタートアップ
 extern void intr_softerr(void);     // ソフトウェアエラー
 extern void intr_syscall(void);     // システムコール
 extern void intr_serintr(void);     // シリアル割り込み
+extern void intr_timintr(void);     // タイマ割り込み
 
 void (*vectors[])(void) = {
   start, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-  intr_syscall, intr_softerr, intr_serintr,
-  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
-  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  intr_syscall, intr_softerr, intr_serintr, NULL,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  NULL, NULL, NULL, NULL,
+  intr_timintr, NULL, NULL, NULL,   // 16ビットタイマ チャネル0の割り込みベクタ
+  intr_timintr, NULL, NULL, NULL,   // 16ビットタイマ チャネル1の割り込みベクタ
+  intr_timintr, NULL, NULL, NULL,   // 16ビットタイマ チャネル2の割り込みベクタ
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
   intr_serintr, intr_serintr, intr_serintr, intr_serintr,   // SCI0の割り込みベクタ
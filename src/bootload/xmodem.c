@@ -56,7 +56,8 @@ static int xmodem_read_block(unsigned char block_number, char *buf)
     return i;
 }
 
-long xmodem_recv(char *buf)
+// bufsizeを超えるデータは受信せずに中断する
+long xmodem_recv(char *buf, long bufsize)
 {
     int r, recieving = 0;
     long size = 0;
@@ -77,6 +78,11 @@ long xmodem_recv(char *buf)
         } else if (c == XMODEM_SOH) {
             // SOHを受信したらデータ受信を開始
             recieving++;
+            if (size + XMODEM_BLOCK_SIZE > bufsize) {
+                // バッファに収まらないので中断する
+                serial_send_byte(SERIAL_DEFAULT_DEVICE, XMODEM_CAN);
+                return -1;
+            }
             r = xmodem_read_block(block_number, buf);
             if (r < 0) {
                 // エラー時にはNAKを返す
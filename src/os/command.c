@@ -6,40 +6,56 @@
 // コンソールドライバの使用開始をドライバに依頼
 static void send_use(int index)
 {
-    char *p;
-    p = kz_kmalloc(3);
-    p[0] = '0';
-    p[1] = CONSDRV_CMD_USE; // 初期化コマンドをセット
-    p[2] = '0' + index;
-    // コンソールドライバのスレッドにメッセージを送信
-    kz_send(MSGBOX_ID_CONSOUTPUT, 3, p);
+    char buf[3];
+    buf[0] = '0';
+    buf[1] = CONSDRV_CMD_USE; // 初期化コマンドをセット
+    buf[2] = '0' + index;
+    // コンソールドライバのスレッドにメッセージを送信(短いのでコピーで送る)
+    kz_sendi(MSGBOX_ID_CONSOUTPUT, 3, buf);
 }
 
 // コンソールへの文字列出力をドライバに依頼
 static void send_write(char *str)
 {
     char *p;
+    char buf[KZ_MSG_INLINE_SIZE];
     int len;
     len = strlen(str);
-    p = kz_kmalloc(len + 2);
+    if (len + 2 <= KZ_MSG_INLINE_SIZE) {
+        // 短い文字列はメモリを確保せずにコピーで送る
+        buf[0] = '0';
+        buf[1] = CONSDRV_CMD_WRITE;
+        memcpy(&buf[2], str, len);
+        kz_sendi(MSGBOX_ID_CONSOUTPUT, len + 2, buf);
+        return;
+    }
+    // メモリが空くまで待つ(大きすぎて確保できない文字列は出力しない)
+    p = kz_kmalloc_wait(len + 2);
+    if (p == NULL) {
+        return;
+    }
     p[0] = '0';
     p[1] = CONSDRV_CMD_WRITE;   // 文字列出力コマンドを設定
     memcpy(&p[2], str, len);
     // コンソールドライバのスレッドにメッセージを送信
-    kz_send(MSGBOX_ID_CONSOUTPUT, len + 2, p);
+    if (kz_send(MSGBOX_ID_CONSOUTPUT, len + 2, p) < 0) {
+        kz_kmfree(p);
+    }
 }
 
 // コマンドスレッドのmain関数
 int command_main(int argc, char *argv[])
 {
     char *p;
+    char buf[KZ_MSG_INLINE_SIZE + 1];
     int size;
     send_use(SERIAL_DEFAULT_DEVICE);
 
     while (1) {
         send_write("command> ");
         // コンソールドライバのスレッドから受信文字列を受け取る
-        kz_recv(MSGBOX_ID_CONSINPUT, &size, &p);
+        // 短い文字列はbufにコピーされて届く
+        kz_recvbuf(MSGBOX_ID_CONSINPUT, &size, &p, buf);
         p[size] = '\0';
 
         // echoコマンドを処理する
@@ -49,7 +65,9 @@ int command_main(int argc, char *argv[])
         } else {
             send_write("unknown.\n");
         }
-        kz_kmfree(p);
+        if (p != buf) {
+            kz_kmfree(p);
+        }
     }
     return 0;
 }
@@ -70,9 +70,20 @@ static int consdrv_intrproc(struct consreg *cons)
                 cons->recv_buf[cons->recv_len++] = c;
             } else {
                 // 改行が押されたら受信データをコマンドスレッドに送信する
-                p = kx_kmalloc(CONS_BUFFER_SIZE);
-                memcpy(p, cons->recv_buf, cons->recv_len);
-                kx_send(MSGBOX_ID_CONSINPUT, cons->recv_len, p);
+                if (cons->recv_len <= KZ_MSG_INLINE_SIZE) {
+                    // 短ければメモリを確保せずにコピーで送る(満杯なら捨てる)
+                    kx_sendi(MSGBOX_ID_CONSINPUT, cons->recv_len, cons->recv_buf);
+                } else {
+                    // 割り込み中は待てないので、メモリが無ければ受信データは捨てる
+                    p = kx_kmalloc(CONS_BUFFER_SIZE);
+                    if (p) {
+                        memcpy(p, cons->recv_buf, cons->recv_len);
+                        if (kx_send(MSGBOX_ID_CONSINPUT, cons->recv_len, p) < 0) {
+                            // キューが満杯なので受信データは捨てる
+                            kx_kmfree(p);
+                        }
+                    }
+                }
                 cons->recv_len = 0;
             }
         }
@@ -123,8 +134,8 @@ static int consdrv_command(struct consreg *cons, kz_thread_id_t id, int index,
         case CONSDRV_CMD_USE:   // コンソールの初期化コマンド
             cons->id = id;
             cons->index = command[1] - '0';
-            cons->send_buf = kz_kmalloc(CONS_BUFFER_SIZE);  // 送信バッファを取得
-            cons->recv_buf = kz_kmalloc(CONS_BUFFER_SIZE);  // 受信バッファを取得
+            cons->send_buf = kz_kmalloc_wait(CONS_BUFFER_SIZE); // 送信バッファを取得
+            cons->recv_buf = kz_kmalloc_wait(CONS_BUFFER_SIZE); // 受信バッファを取得
             cons->send_len = 0;
             cons->recv_len = 0;
             serial_init(cons->index);               // シリアルの初期化
@@ -146,6 +157,7 @@ int consdrv_main(int argc, char *argv[])
     int size, index;
     kz_thread_id_t id;
     char *p;
+    char buf[KZ_MSG_INLINE_SIZE];
 
     consdrv_init();
     // 割り込みハンドラを設定する
@@ -153,11 +165,14 @@ int consdrv_main(int argc, char *argv[])
 
     while (1) {
         // 他スレッドからのコマンドの受付
-        id = kz_recv(MSGBOX_ID_CONSOUTPUT, &size, &p);
+        // 短いコマンドはbufにコピーされて届く
+        id = kz_recvbuf(MSGBOX_ID_CONSOUTPUT, &size, &p, buf);
         index = p[0] - '0';
         // コマンド処理を呼び出す
         consdrv_command(&consreg[index], id, index, size - 1, p + 1);
-        kz_kmfree(p);
+        if (p != buf) {
+            kz_kmfree(p);
+        }
     }
 
     return 0;
@@ -3,21 +3,55 @@
 
 #define NULL ((void *)0)
 #define SERIAL_DEFAULT_DEVICE 1
+#define TIMER_DEFAULT_DEVICE 0  // システムタイマに使う16ビットタイマのチャネル
+#define KZ_TICK_MSEC 1          // システムタイマの周期(ミリ秒)
+#define KZ_TIMEOUT_FOREVER (-1) // タイムアウトしない
+#define KZ_MSG_INLINE_SIZE 12   // kz_sendi()でメッセージに直接コピーできる最大のサイズ
+
+// イベントフラグの待ち合わせモード
+#define KZ_FLAG_WAIT_OR     0           // いずれかのビットがセットされるのを待つ
+#define KZ_FLAG_WAIT_AND    (1 << 0)    // すべてのビットがセットされるのを待つ
+#define KZ_FLAG_WAIT_CLEAR  (1 << 1)    // 待ち解除時に待っていたビットをクリアする
 
 typedef unsigned char   uint8;
 typedef unsigned short  uint16;
 typedef unsigned long   uint32;
 
 typedef uint32 kz_thread_id_t;
+typedef int kz_mutex_id_t;
+typedef int kz_sem_id_t;
+typedef int kz_flag_id_t;
 typedef int (*kz_func_t)(int argc, char *argv[]);
 typedef void (*kz_handler_t)(void);
 
+// スレッドの統計情報
+typedef struct {
+    uint32 dispatch;        // ディスパッチされた回数
+    uint32 ticks;           // 実行中に経過したティック数
+    uint32 syscall;         // システムコールの発行回数
+    uint32 voluntary;       // 待ちに入って切り替わった回数
+    uint32 involuntary;     // 動作可能なまま横取りされた回数
+    uint32 kmem;            // 確保中の動的メモリのバイト数(ヘッダを含む)
+} kz_thread_stat_t;
+
+// 静的に用意されるメッセージボックス
+// これ以降のIDはkz_mbox_create()で生成し、kz_mbox_lookup()で名前から求める
 typedef enum {
     MSGBOX_ID_MSGBOX1 = 0,
     MSGBOX_ID_MSGBOX2,
-    MSGBOX_ID_CONSINPUT = 0,
+    MSGBOX_ID_CONSINPUT,
     MSGBOX_ID_CONSOUTPUT,
-    MSGBOX_ID_NUM
+    MSGBOX_ID_STATIC_NUM
 } kz_msgbox_id_t;
 
+// kz_select()で待つメッセージボックスのマスク
+#define KZ_MSGBOX_MASK(id) (1UL << (id))
+
+// kz_sendv()でまとめて送信するメッセージ
+typedef struct {
+    kz_msgbox_id_t id;
+    int size;
+    char *p;
+} kz_msgvec_t;
+
 #endif
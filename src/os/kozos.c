@@ -5,10 +5,86 @@
 #include "syscall.h"
 #include "lib.h"
 #include "memory.h"
+#include "timer.h"
 
+// TCBの数(ビルド時に-DTHREAD_NUM=nで変更できる)
+#ifndef THREAD_NUM
 #define THREAD_NUM 6
+#endif
 #define THREAD_NAME_SIZE 15
 #define PRIORITY_NUM 16
+#define MUTEX_NUM 8
+#define SEM_NUM 8
+#define FLAG_NUM 8
+#define MSGBUF_NUM 16           // メッセージバッファの総数(すべてのメッセージボックスで共有する)
+#define MSGBOX_MSGBUF_QUOTA 8   // 1つのメッセージボックスにためられるメッセージの数
+#ifdef KZ_MBOX_NAMED
+#define MSGBOX_DYNAMIC_NUM 4    // kz_mbox_create()で生成できるメッセージボックス数
+#define MSGBOX_NAME_SIZE 15
+#else
+#define MSGBOX_DYNAMIC_NUM 0
+#endif
+#define MSGBOX_ID_NUM (MSGBOX_ID_STATIC_NUM + MSGBOX_DYNAMIC_NUM)
+// メッセージボックスごとの優先度帯の数
+// 送信したスレッドの優先度で帯を決め、優先度の高い帯のメッセージから受信する
+#define MSGBOX_BAND_NUM 4
+#define MSGBOX_BAND(pri) ((pri) * MSGBOX_BAND_NUM / PRIORITY_NUM)
+// 割り込みスタック(intrstackから下位方向)に残しておくサイズ
+#define INTRSTACK_SIZE 0x100
+#ifdef KZ_STACK_WATERMARK
+// スタックの未使用部分を塗りつぶすパターン
+#define STACK_PAINT 0xa5
+#endif
+// スタックの最下位に置くガードワード
+#define STACK_GUARD 0x5aa5c33cUL
+
+// レディーキューのビットマップ
+// 優先度16個ごとに1ワードのビットマップを持ち、空でないワードをグループのビットマップで管理する
+#define PRIORITY_MAP_NUM ((PRIORITY_NUM + 15) / 16)
+#define PRIORITY_MAP_INDEX(pri) ((pri) >> 4)
+#define PRIORITY_MAP_BIT(pri)   (1U << ((pri) & 15))
+
+#if PRIORITY_NUM > 256
+#error "PRIORITY_NUM must be 256 or less"
+#endif
+
+// スレッドIDは下位8ビットがTCBのインデックス、上位が世代番号となる
+// TCBが再利用されると世代番号が変わるので、終了したスレッドのIDは無効になる
+#define THREAD_ID(index, gen)   (((kz_thread_id_t)(gen) << 8) | (index))
+#define THREAD_ID_INDEX(id)     ((int)((id) & 0xff))
+// メモリブロックに記録する所有者(0はカーネルや割り込み)
+#define KMEM_OWNER(thp)         ((thp) ? (thp)->index + 1 : 0)
+
+#if THREAD_NUM > 255
+#error "THREAD_NUM must be 255 or less"
+#endif
+
+#if MSGBOX_BAND_NUM > 8
+#error "MSGBOX_BAND_NUM must be 8 or less"
+#endif
+
+#ifdef KZ_MSG_SELECT
+// kz_select()のマスクは32ビットなので、静的なもの(4個)と合わせて31個まで
+#if MSGBOX_DYNAMIC_NUM > 27
+#error "MSGBOX_DYNAMIC_NUM is too large for the kz_select() mask"
+#endif
+#endif
+
+// システムタイマ1周期あたりのカウント数
+#define TICK_COUNT (TIMER_COUNT_PER_MSEC * KZ_TICK_MSEC)
+// タイムスライスの初期値(ティック数、0ならタイムスライスしない)
+#define TIMESLICE_DEFAULT 10
+
+#if TICK_COUNT > 0xffff
+#error "KZ_TICK_MSEC is too large for the 16-bit timer"
+#endif
+
+#ifdef KZ_TICKLESS
+// ティックレス動作で一度に止められる最大のティック数
+#define TICKLESS_MAX (0xffff / TICK_COUNT)
+// ティック境界の直前で周期を戻すと周期を取りこぼすので、その分の余裕(カウント数)
+#define TICKLESS_MARGIN 16
+#endif
 
 // スレッドのコンテキスト保存用の構造体
 typedef struct _kz_context {
@@ -16,14 +92,27 @@ typedef struct _kz_context {
     uint32 sp;
 } kz_context;
 
+struct _kz_waitque;
+struct _kz_mutex;
+
 // タスクコントロールブロック
 typedef struct _kz_thread {
-    struct _kz_thread *next;            // レディーキューへの接続に利用するnextポインタ
+    struct _kz_thread *next;            // レディーキュー(待ち状態では待ちキュー)への接続に利用するnextポインタ
     char name[THREAD_NAME_SIZE + 1];    // スレッド名
-    int priority;                       // 優先度
+    kz_thread_id_t id;                  // スレッドID(未使用なら0)
+    uint16 gen;                         // TCBの世代番号
+    uint8 index;                        // threads[]内のインデックス
+    int priority;                       // 優先度(優先度継承による引き上げを含む)
+    int basepri;                        // 本来の優先度
+    int slice;                          // 残りのタイムスライス(ティック数)
     char *stack;                        // スレッドのスタック
+    int stackpool;                      // スタックを獲得したサイズクラス
     uint32 flags;
 #define KZ_THREAD_FLAG_READY (1 << 0)
+#define KZ_THREAD_FLAG_TIMER (1 << 1)   // タイマキューに接続中
+#ifdef KZ_MSG_CALL
+#define KZ_THREAD_FLAG_RECEIVED (1 << 2) // kz_call()の要求がサーバに受信された
+#endif
 
     // スレッドのスタートアップ(thread_init())に渡すパラメータ
     struct {
@@ -32,6 +121,22 @@ typedef struct _kz_thread {
         char **argv;        // main関数の引数(argv)
     } init;
 
+#ifdef KZ_THREAD_STAT
+    kz_thread_stat_t stat;              // 統計情報
+#endif
+
+    struct _kz_waitque *waitque;        // 接続されている待ちキュー
+#ifdef KZ_MUTEX
+    struct _kz_mutex *mutex;            // 獲得中のミューテックスのリスト
+#endif
+
+    // タイマキューへの接続に利用する
+    struct {
+        struct _kz_thread *next;
+        struct _kz_thread *prev;
+        int delta;          // 直前のスレッドからの相対ティック数
+    } timer;
+
     // システムコール用バッファ
     struct {
         kz_syscall_type_t type;
@@ -41,27 +146,74 @@ typedef struct _kz_thread {
     kz_context context;     // スレッドのコンテキスト情報
 } kz_thread;
 
+// 待ちキューの構造体
+// スレッドを優先度順(同じ優先度なら到着順)に並べる
+typedef struct _kz_waitque {
+    kz_thread *head;
+} kz_waitque;
+
+#ifdef KZ_MUTEX
+// ミューテックスの構造体
+typedef struct _kz_mutex {
+    struct _kz_mutex *next;     // 所有スレッドが獲得中のミューテックスのリスト
+    kz_thread *owner;           // 所有スレッド
+    kz_waitque waitque;         // 獲得待ちのスレッド
+    int used;                   // 生成済みか
+} kz_mutex;
+#endif
+
+#ifdef KZ_SEMFLAG
+// セマフォの構造体
+typedef struct _kz_sem {
+    int count;                  // 資源の数
+    kz_waitque waitque;         // 資源待ちのスレッド
+    int used;                   // 生成済みか
+} kz_sem;
+
+// イベントフラグの構造体
+typedef struct _kz_flag {
+    uint16 pattern;             // セットされているビットパターン
+    kz_waitque waitque;         // パターン待ちのスレッド
+    int used;                   // 生成済みか
+} kz_flag;
+#endif
+
 // タスク間通信のメッセージ構造体
 typedef struct _kz_msgbuf {
     struct _kz_msgbuf *next;
     // メッセージを送信したスレッド
-    kz_thread *sender;
+    kz_thread_id_t sender;
     // メッセージのパラメータを保存する構造体
     struct {
         int size;
-        char *p;
+        uint8 flags;
+#define MSGBUF_FLAG_COPIED (1 << 0)     // 本体をdataにコピーした(kz_sendi())
+#ifdef KZ_MSG_CALL
+#define MSGBUF_FLAG_CALL   (1 << 1)     // kz_call()の要求
+#endif
+        union {
+            char *p;
+            char data[KZ_MSG_INLINE_SIZE];
+        } u;
     } param;
 } kz_msgbuf;
 
 // メッセージを入れるボックスの構造体
+// メッセージバッファは共有の静的なプールから取り、送受信でメモリプールを使わない
 typedef struct _kz_msgbox {
-    // メッセージ受信待ちのスレッド
-    kz_thread *receiver;
-    // メッセージキュー
-    kz_msgbuf *head;
-    kz_msgbuf *tail;
-    // 構造体のサイズを調整するダミーメンバ
-    long dummy[1];
+    // メッセージ受信待ちのスレッド(優先度順)
+    kz_waitque receivers;
+    // メッセージキュー(優先度帯ごと、帯0が最も優先度が高い)
+    struct {
+        kz_msgbuf *head;
+        kz_msgbuf *tail;
+    } bands[MSGBOX_BAND_NUM];
+    uint8 bandmap;              // メッセージがある優先度帯のビットマップ
+    uint8 count;                // キューにあるメッセージの数(MSGBOX_MSGBUF_QUOTAまで)
+#ifdef KZ_MBOX_NAMED
+    char name[MSGBOX_NAME_SIZE + 1];    // kz_mbox_lookup()で探す名前
+#endif
+    int used;                           // 生成済みか
 } kz_msgbox;
 
 // スレッドのレディーキュー
@@ -70,12 +222,73 @@ static struct {
     kz_thread *tail;    // キューの末尾エントリ
 } readyque[PRIORITY_NUM];
 
+static uint16 readygrp;                             // 空でないビットマップのワード
+static uint16 readymap[PRIORITY_MAP_NUM];           // 動作可能なスレッドがいる優先度
+
 static kz_thread *current;                          // 現在実行中のスレッド
+static kz_thread *timerque;                         // タイマキュー(満了時刻順)
+static kz_thread *idle;                             // アイドルスレッド(初期スレッド)
+#ifdef KZ_TICKLESS
+static int tickless;                                // ティックレス動作中のティック数(0なら周期動作)
+#endif
 static kz_thread threads[THREAD_NUM];               // タスクコントロールブロック
+static kz_thread *freethreads;                      // 未使用のTCBのリスト
+static char *stackarea;                             // スタック領域の未使用部分の先頭
 static kz_handler_t handlers[SOFTVEC_TYPE_NUM];     // OSが管理する割り込みハンドラ
-static kz_msgbox msgboxes[MSGBOX_ID_NUM];           // メッセージボックスの定義
+
+// スタックのサイズクラス
+// 解放されたスタックはサイズクラスごとのリストに戻し、同じクラスの要求に再利用する
+static struct {
+    int size;
+    char *free;     // 解放済みスタックのリスト(スタック領域の先頭に次へのポインタを置く)
+} stackpool[] = {
+        {0x100, NULL},
+        {0x200, NULL},
+        {0x400, NULL},
+        {0x800, NULL},
+};
+
+#define STACK_POOL_NUM (sizeof(stackpool) / sizeof(*stackpool))
+static kz_msgbuf msgbufs[MSGBUF_NUM];               // メッセージバッファの実体
+static kz_msgbuf *freemsgbufs;                      // 未使用のメッセージバッファのリスト
+static kz_msgbox msgboxes[MSGBOX_ID_NUM];           // メッセージボックスの定義(IDで直接引く)
+#ifdef KZ_MBOX_NAMED
+static char *msgbox_names[MSGBOX_ID_STATIC_NUM] = { // 静的なメッセージボックスの名前
+        "msgbox1", "msgbox2", "consinput", "consoutput",
+};
+#endif
+static kz_waitque kmwaiters;                        // メモリの解放を待っているスレッド(優先度順)
+#ifdef KZ_MSG_SELECT
+static kz_waitque selectors;                        // kz_select()で待っているスレッド(優先度順)
+#endif
+static int msgpending;                              // メモリ不足で受信待ちのスレッドに渡せないメッセージがある
+static int timeslice[PRIORITY_NUM];                 // 優先度ごとのタイムスライス
+#ifdef KZ_MUTEX
+static kz_mutex mutexes[MUTEX_NUM];                 // ミューテックスの定義
+#endif
+#ifdef KZ_SEMFLAG
+static kz_sem sems[SEM_NUM];                        // セマフォの定義
+static kz_flag eventflags[FLAG_NUM];                // イベントフラグの定義
+#endif
 
 void dispatch(kz_context *context);                 // スレッドのディスパッチ用関数
+static void msgbox_deliver(kz_msgbox_id_t id);      // kmem_wakeup()から呼び出す
+
+// 優先度のキューが空でなくなったことをビットマップに反映する
+static void readymap_set(int priority)
+{
+    readymap[PRIORITY_MAP_INDEX(priority)] |= PRIORITY_MAP_BIT(priority);
+    readygrp |= 1U << PRIORITY_MAP_INDEX(priority);
+}
+
+// 優先度のキューが空になったことをビットマップに反映する
+static void readymap_clear(int priority)
+{
+    readymap[PRIORITY_MAP_INDEX(priority)] &= ~PRIORITY_MAP_BIT(priority);
+    if (!readymap[PRIORITY_MAP_INDEX(priority)]) {
+        readygrp &= ~(1U << PRIORITY_MAP_INDEX(priority));
+    }
+}
 
 // 実行中のスレッドをキューから抜き出す
 static int getcurrent(void)
@@ -91,6 +304,8 @@ static int getcurrent(void)
     readyque[current->priority].head = current->next;
     if (readyque[current->priority].head == NULL) {
         readyque[current->priority].tail = NULL;
+        // キューが空になったのでビットマップを落とす
+        readymap_clear(current->priority);
     }
     // READYビットを落とす
     current->flags &= ~KZ_THREAD_FLAG_READY;
@@ -114,13 +329,426 @@ static int putcurrent(void)
         readyque[current->priority].tail->next = current;
     } else {
         readyque[current->priority].head = current;
+        // キューが空でなくなったのでビットマップを立てる
+        readymap_set(current->priority);
     }
     readyque[current->priority].tail = current;
+    // タイムスライスを補充する
+    current->slice = timeslice[current->priority];
+    // READYビットを立てる
+    current->flags |= KZ_THREAD_FLAG_READY;
+
+    return 0;
+}
+
+#ifdef KZ_MSG_CALL
+// カレントスレッドをレディーキューの先頭につなぐ
+// 同じ優先度のスレッドより先に動作させたいとき(call/replyの直接切り替え)に使う
+static int putcurrent_head(void)
+{
+    if (current == NULL) {
+        return -1;
+    }
+    if (current->flags & KZ_THREAD_FLAG_READY) {
+        // すでにある場合は何もしない
+        return 1;
+    }
+    // キューの先頭に接続する
+    current->next = readyque[current->priority].head;
+    readyque[current->priority].head = current;
+    if (readyque[current->priority].tail == NULL) {
+        readyque[current->priority].tail = current;
+        // キューが空でなくなったのでビットマップを立てる
+        readymap_set(current->priority);
+    }
+    // タイムスライスを補充する
+    current->slice = timeslice[current->priority];
     // READYビットを立てる
     current->flags |= KZ_THREAD_FLAG_READY;
 
     return 0;
 }
+#endif
+
+// 実行中でないスレッドをレディーキューから抜き出す
+static void readyque_remove(kz_thread *thp)
+{
+    kz_thread **thpp;
+    kz_thread *prev = NULL;
+
+    if (!(thp->flags & KZ_THREAD_FLAG_READY)) {
+        return;
+    }
+    for (thpp = &readyque[thp->priority].head; *thpp != thp; thpp = &(*thpp)->next) {
+        prev = *thpp;
+    }
+    *thpp = thp->next;
+    if (readyque[thp->priority].tail == thp) {
+        readyque[thp->priority].tail = prev;
+    }
+    if (readyque[thp->priority].head == NULL) {
+        readymap_clear(thp->priority);
+    }
+    thp->flags &= ~KZ_THREAD_FLAG_READY;
+    thp->next = NULL;
+}
+
+// スレッドを待ちキューにつなげる
+static void waitque_put(kz_waitque *que, kz_thread *thp)
+{
+    kz_thread **thpp;
+
+    // 優先度の低いスレッドの手前に挿入する
+    for (thpp = &que->head; *thpp; thpp = &(*thpp)->next) {
+        if ((*thpp)->priority > thp->priority) {
+            break;
+        }
+    }
+    thp->next = *thpp;
+    *thpp = thp;
+    thp->waitque = que;
+}
+
+// 待ちキューの先頭のスレッドを取り出す
+static kz_thread *waitque_get(kz_waitque *que)
+{
+    kz_thread *thp = que->head;
+
+    if (thp) {
+        que->head = thp->next;
+        thp->next = NULL;
+        thp->waitque = NULL;
+    }
+    return thp;
+}
+
+// スレッドを待ちキューから外す
+static void waitque_remove(kz_thread *thp)
+{
+    kz_thread **thpp;
+
+    if (!thp->waitque) {
+        return;
+    }
+    for (thpp = &thp->waitque->head; *thpp; thpp = &(*thpp)->next) {
+        if (*thpp == thp) {
+            *thpp = thp->next;
+            break;
+        }
+    }
+    thp->next = NULL;
+    thp->waitque = NULL;
+}
+
+// 実行中でないスレッドの優先度を変更し、つながっているキューの位置を直す
+static void thread_setpri(kz_thread *thp, int priority)
+{
+    kz_thread *cur = current;
+    kz_waitque *que = thp->waitque;
+
+    if (thp->flags & KZ_THREAD_FLAG_READY) {
+        readyque_remove(thp);
+        thp->priority = priority;
+        current = thp;
+        putcurrent();
+        current = cur;
+    } else if (que) {
+        waitque_remove(thp);
+        thp->priority = priority;
+        waitque_put(que, thp);
+    } else {
+        thp->priority = priority;
+    }
+}
+
+// スレッドIDからTCBを取得する(無効なIDならNULL)
+static kz_thread *thread_lookup(kz_thread_id_t id)
+{
+    int index = THREAD_ID_INDEX(id);
+
+    if ((index >= THREAD_NUM) || (threads[index].id != id) || !id) {
+        return NULL;
+    }
+    return &threads[index];
+}
+
+// スレッドをタイマキューにつなげる
+// キューは満了時刻順に並べ、各スレッドには直前のスレッドからの相対ティック数を持たせる
+static void timerque_put(kz_thread *thp, int ticks)
+{
+    kz_thread *prev = NULL;
+    kz_thread *next = timerque;
+
+    // 相対ティック数を差し引きながら挿入位置を探す
+    while (next && next->timer.delta <= ticks) {
+        ticks -= next->timer.delta;
+        prev = next;
+        next = next->timer.next;
+    }
+    thp->timer.delta = ticks;
+    thp->timer.prev = prev;
+    thp->timer.next = next;
+    if (next) {
+        next->timer.delta -= ticks;
+        next->timer.prev = thp;
+    }
+    if (prev) {
+        prev->timer.next = thp;
+    } else {
+        timerque = thp;
+    }
+    thp->flags |= KZ_THREAD_FLAG_TIMER;
+}
+
+// スレッドをタイマキューから外す
+static void timerque_remove(kz_thread *thp)
+{
+    if (!(thp->flags & KZ_THREAD_FLAG_TIMER)) {
+        return;
+    }
+    // 残りのティック数は後ろのスレッドに引き継ぐ
+    if (thp->timer.next) {
+        thp->timer.next->timer.delta += thp->timer.delta;
+        thp->timer.next->timer.prev = thp->timer.prev;
+    }
+    if (thp->timer.prev) {
+        thp->timer.prev->timer.next = thp->timer.next;
+    } else {
+        timerque = thp->timer.next;
+    }
+    thp->timer.next = NULL;
+    thp->timer.prev = NULL;
+    thp->flags &= ~KZ_THREAD_FLAG_TIMER;
+}
+
+// タイムアウトしたスレッドを動作可能にする
+static void thread_timeout(kz_thread *thp)
+{
+    // 待ちキューにつながっていれば外す
+    waitque_remove(thp);
+    // 待っていたシステムコールにタイムアウトを返す
+    switch (thp->syscall.type) {
+        case KZ_SYSCALL_TYPE_SLEEP:
+            thp->syscall.param->un.sleep.ret = -1;
+            break;
+        case KZ_SYSCALL_TYPE_RECV:
+            thp->syscall.param->un.recv.ret = -1;
+            break;
+        default:
+            break;
+    }
+    current = thp;
+    putcurrent();
+}
+
+// 経過したティック数をタイマキューに反映する
+// 先頭から満了したスレッドだけを取り出すので、1ティックあたりの処理は満了したスレッド数に比例する
+static void timerque_tick(int ticks)
+{
+    kz_thread *thp;
+
+    while ((thp = timerque) != NULL && thp->timer.delta <= ticks) {
+        ticks -= thp->timer.delta;
+        thp->timer.delta = 0;
+        timerque_remove(thp);
+        thread_timeout(thp);
+    }
+    if (thp) {
+        thp->timer.delta -= ticks;
+    }
+}
+
+#ifdef KZ_MUTEX
+// スレッドが獲得中のミューテックスを待つスレッドの優先度を継承した優先度を求める
+static int mutex_priority(kz_thread *thp)
+{
+    kz_mutex *mtxp;
+    int priority = thp->basepri;
+
+    for (mtxp = thp->mutex; mtxp; mtxp = mtxp->next) {
+        if (mtxp->waitque.head && (mtxp->waitque.head->priority < priority)) {
+            priority = mtxp->waitque.head->priority;
+        }
+    }
+    return priority;
+}
+
+// ミューテックスの所有スレッドにpriorityを継承させる
+// 所有スレッドがさらに別のミューテックスを待っていれば、その所有スレッドにも継承させる
+static void mutex_inherit(kz_mutex *mtxp, int priority)
+{
+    kz_thread *thp;
+
+    while ((thp = mtxp->owner) != NULL && (thp->priority > priority)) {
+        thread_setpri(thp, priority);
+        if (!thp->waitque || (thp->syscall.type != KZ_SYSCALL_TYPE_MUTEX_LOCK)) {
+            break;
+        }
+        mtxp = &mutexes[thp->syscall.param->un.mutex_lock.id];
+    }
+}
+
+// ミューテックスを解放し、最も優先度の高い待ちスレッドに所有権を渡す
+static void mutex_release(kz_mutex *mtxp)
+{
+    kz_mutex **mpp;
+    kz_thread *thp;
+    kz_thread *cur = current;
+
+    // 所有スレッドの獲得中リストから外す
+    for (mpp = &mtxp->owner->mutex; *mpp != mtxp; mpp = &(*mpp)->next)
+        ;
+    *mpp = mtxp->next;
+    mtxp->next = NULL;
+
+    thp = waitque_get(&mtxp->waitque);
+    mtxp->owner = thp;
+    if (thp) {
+        mtxp->next = thp->mutex;
+        thp->mutex = mtxp;
+        // 残りの待ちスレッドの優先度を継承してからキューに戻す
+        thp->priority = mutex_priority(thp);
+        current = thp;
+        putcurrent();
+        current = cur;
+    }
+}
+#endif
+
+// スタックを獲得し、スタック領域の先頭(下位アドレス)を返す
+static char *stack_alloc(int size, int *poolp)
+{
+    extern char intrstack;
+    char *stack;
+    int i;
+
+    // 要求サイズを格納できるサイズクラスを探す
+    for (i = 0; i < STACK_POOL_NUM; i++) {
+        if (size <= stackpool[i].size) {
+            break;
+        }
+    }
+    if (i == STACK_POOL_NUM) {
+        return NULL;
+    }
+    if (stackpool[i].free) {
+        // 解放済みのスタックを再利用する
+        stack = stackpool[i].free;
+        stackpool[i].free = *(char **)stack;
+    } else {
+        // 未使用部分から切り出す
+        if (stackpool[i].size > (&intrstack - INTRSTACK_SIZE) - stackarea) {
+            return NULL;
+        }
+        stack = stackarea;
+        stackarea += stackpool[i].size;
+    }
+    *poolp = i;
+    return stack;
+}
+
+// スタック領域の先頭(下位アドレス)を求める
+static char *stack_base(kz_thread *thp)
+{
+    return thp->stack - stackpool[thp->stackpool].size;
+}
+
+// スタックあふれを検査する
+// ガードワードが壊されているか、スタックポインタがガードワードより下にあればあふれている
+static int stack_overflow(kz_thread *thp, unsigned long sp)
+{
+    char *base = stack_base(thp);
+
+    return (*(uint32 *)base != STACK_GUARD) || (sp < (unsigned long)(base + sizeof(uint32)));
+}
+
+// スタックを解放する
+static void stack_free(char *stack, int pool)
+{
+    *(char **)stack = stackpool[pool].free;
+    stackpool[pool].free = stack;
+}
+
+// メモリを確保し、スレッドthpの使用量に加える(thpがNULLならカーネルの確保)
+static void *kmem_alloc(int size, kz_thread *thp)
+{
+    void *mem;
+
+    mem = kzmem_alloc(size, KMEM_OWNER(thp));
+#ifdef KZ_THREAD_STAT
+    if (mem && thp) {
+        thp->stat.kmem += kzmem_size(mem);
+    }
+#endif
+    return mem;
+}
+
+// メモリを解放し、確保したスレッドの使用量から引く
+static void kmem_free(void *mem)
+{
+    int owner = kzmem_owner(mem);
+
+    if (owner < 0) {
+        // 確保中のブロックではない
+        kz_sysdown();
+        return;
+    }
+#ifdef KZ_THREAD_STAT
+    if (owner) {
+        threads[owner - 1].stat.kmem -= kzmem_size(mem);
+    }
+#endif
+    kzmem_free(mem);
+}
+
+// メッセージで渡したメモリの所有者をスレッドthpに移す(NULLなら送信中としてカーネルの所有にする)
+// 確保中のブロックでなければ何もしない
+static void kmem_chown(void *mem, kz_thread *thp)
+{
+    int owner = kzmem_owner(mem);
+
+    if (owner < 0) {
+        return;
+    }
+#ifdef KZ_THREAD_STAT
+    if (owner) {
+        threads[owner - 1].stat.kmem -= kzmem_size(mem);
+    }
+#endif
+    kzmem_chown(mem, KMEM_OWNER(thp));
+#ifdef KZ_THREAD_STAT
+    if (thp) {
+        thp->stat.kmem += kzmem_size(mem);
+    }
+#endif
+}
+
+// メモリの解放を待っているスレッドのうち、確保できたものを優先度の高い順に起こす
+// メモリ不足で渡せなかったメッセージも受信待ちのスレッドに渡し直す
+static void kmem_wakeup(void)
+{
+    kz_thread *thp, *next;
+    void *mem;
+    int i;
+
+    for (thp = kmwaiters.head; thp; thp = next) {
+        next = thp->next;
+        mem = kmem_alloc(thp->syscall.param->un.kmalloc.size, thp);
+        if (mem) {
+            waitque_remove(thp);
+            thp->syscall.param->un.kmalloc.ret = mem;
+            current = thp;
+            putcurrent();
+        }
+    }
+    if (msgpending) {
+        // まだ足りなければrecvmsg()で再びセットされる
+        msgpending = 0;
+        for (i = 0; i < MSGBOX_ID_NUM; i++) {
+            msgbox_deliver(i);
+        }
+    }
+}
 
 // スレッドの終了
 static void thread_end(void)
@@ -139,39 +767,53 @@ static void thread_init(kz_thread *thp)
 // システムコールの処理
 static kz_thread_id_t thread_run(kz_func_t func, char *name, int priority, int stacksize, int argc, char *argv[])
 {
-    int i;
     kz_thread *thp;
+    uint16 gen;
+    uint8 index;
     uint32 *sp;
-    extern char userstack;
-    static char *thread_stack = &userstack;
+    char *stack;
+    int pool;
 
-    for (i = 0; i < THREAD_NUM; i++) {
-        thp = &threads[i];
-        // 空きがあった
-        if (!thp->init.func) {
-            break;
-        }
+    // 未使用のTCBを取り出す
+    thp = freethreads;
+    if (thp == NULL) {
+        // 空きがなかった
+        putcurrent();
+        return -1;
     }
-    // 空きがなかった
-    if (i == THREAD_NUM) {
+    // スタック領域を獲得
+    stack = stack_alloc(stacksize, &pool);
+    if (stack == NULL) {
+        putcurrent();
         return -1;
     }
-    // TCBをゼロクリア
+    freethreads = thp->next;
+    // TCBをゼロクリア(世代番号とインデックスは引き継ぐ)
+    gen = thp->gen;
+    index = thp->index;
     memset(thp, 0, sizeof(*thp));
+    thp->gen = gen;
+    thp->index = index;
+    thp->id = THREAD_ID(index, gen);
     // TCBの設定
     strcpy(thp->name, name);
     thp->next = NULL;
     thp->priority = priority;
+    thp->basepri = priority;
     thp->flags = 0;
 
     thp->init.func = func;
     thp->init.argc = argc;
     thp->init.argv = argv;
-    // スタック領域を獲得しTCBに設定
-    memset(thread_stack, 0, stacksize);
-    thread_stack += stacksize;
+    // スタック領域をTCBに設定
+    // 使用量を後から測れるようにパターンで塗りつぶし、最下位にガードワードを置く
+#ifdef KZ_STACK_WATERMARK
+    memset(stack, STACK_PAINT, stackpool[pool].size);
+#endif
+    *(uint32 *)stack = STACK_GUARD;
     // スタックを設定
-    thp->stack = thread_stack;
+    thp->stack = stack + stackpool[pool].size;
+    thp->stackpool = pool;
     // スタックの初期化
     sp = (uint32 *)thp->stack;
     *(--sp) = (uint32)thread_end;
@@ -193,15 +835,44 @@ static kz_thread_id_t thread_run(kz_func_t func, char *name, int priority, int s
     current = thp;
     putcurrent();
 
-    return (kz_thread_id_t)current;
+    return current->id;
 }
 
 // スレッドを終了するシステムコール
 static int thread_exit(void)
 {
+    uint16 gen;
+    uint8 index;
+
     puts(current->name);
     puts(" EXIT.\n");
+#ifdef KZ_MUTEX
+    // 獲得中のミューテックスは待ちスレッドに引き渡す
+    while (current->mutex) {
+        mutex_release(current->mutex);
+    }
+#endif
+    // スタックを解放する(処理中は割り込みスタックを使っているので解放してよい)
+    stack_free(stack_base(current), current->stackpool);
+#ifdef KZ_KMEM_RECLAIM
+    // 確保したまま終了したメモリを回収する
+    kzmem_reclaim(KMEM_OWNER(current), 1);
+#else
+    // TCBを再利用するスレッドの所有にならないよう、所有者を外しておく
+    kzmem_reclaim(KMEM_OWNER(current), 0);
+#endif
+    // TCBを未使用に戻し、世代番号を進めて古いIDを無効にする
+    gen = current->gen + 1;
+    index = current->index;
     memset(current, 0, sizeof(*current));
+    current->gen = gen ? gen : 1;
+    current->index = index;
+    current->next = freethreads;
+    freethreads = current;
+#ifdef KZ_KMEM_RECLAIM
+    // 回収したメモリを待っているスレッドを起こす
+    kmem_wakeup();
+#endif
     return 0;
 }
 
@@ -213,8 +884,29 @@ static int thread_wait(void)
 }
 
 // スレッドのsleepするシステムコール
-static int thread_sleep(void)
+// timeoutティック経過してもwakeupされなければ-1を返す
+static int thread_sleep(int timeout)
+{
+    if (timeout == 0) {
+        // 待たずにタイムアウトする
+        putcurrent();
+        return -1;
+    }
+    if (timeout > 0) {
+        timerque_put(current, timeout);
+    }
+    return 0;
+}
+
+// 指定したティック数だけスレッドを停止するシステムコール
+static int thread_delay(int ticks)
 {
+    if (ticks <= 0) {
+        putcurrent();
+        return 0;
+    }
+    // wakeupでは起床せず、タイマの満了でのみキューに戻る
+    timerque_put(current, ticks);
     return 0;
 }
 
@@ -223,7 +915,19 @@ static int thread_wakeup(kz_thread_id_t id)
 {
     putcurrent();
     // 引数で渡したスレッドをキューに戻す
-    current = (kz_thread *)id;
+    current = thread_lookup(id);
+    if (current == NULL) {
+        return -1;
+    }
+    if (current->flags & KZ_THREAD_FLAG_READY) {
+        return 0;
+    }
+    if (current->syscall.type != KZ_SYSCALL_TYPE_SLEEP) {
+        // sleep以外(delayやミューテックスの獲得など)で待っているスレッドは起床させない
+        return -1;
+    }
+    // タイムアウト待ちを解除する
+    timerque_remove(current);
     putcurrent();
     return 0;
 }
@@ -232,129 +936,722 @@ static int thread_wakeup(kz_thread_id_t id)
 static kz_thread_id_t thread_getid(void)
 {
     putcurrent();
-    // TCBのアドレスがスレッドIDとなる
-    return (kz_thread_id_t)current;
+    return current->id;
+}
+
+#ifdef KZ_STACK_WATERMARK
+// スタックの未使用量を取得するシステムコール
+// パターンが残っている部分の大きさ(これまでの最大使用時の残り)を返す
+static int thread_stackfree(kz_thread_id_t id)
+{
+    kz_thread *thp;
+    char *p, *end;
+
+    putcurrent();
+    thp = id ? thread_lookup(id) : current;
+    if (thp == NULL) {
+        return -1;
+    }
+    p = stack_base(thp) + sizeof(uint32);
+    for (end = thp->stack; (p < end) && ((uint8)*p == STACK_PAINT); p++)
+        ;
+    return p - (stack_base(thp) + sizeof(uint32));
+}
+#endif
+
+#ifdef KZ_THREAD_STAT
+// スレッドの統計情報を取得するシステムコール
+static int thread_getstat(kz_thread_id_t id, kz_thread_stat_t *stat)
+{
+    kz_thread *thp;
+
+    putcurrent();
+    thp = id ? thread_lookup(id) : current;
+    if (thp == NULL) {
+        return -1;
+    }
+    memcpy(stat, &thp->stat, sizeof(*stat));
+    return 0;
 }
+#endif
 
 // 優先度の変更をするシステムコール
 static int thread_chpri(int priority)
 {
-    int old = current->priority;
+    int old = current->basepri;
     // 優先度を変更してキューに入れる
     if (priority >= 0) {
+        current->basepri = priority;
+#ifdef KZ_MUTEX
+        // ミューテックスによる優先度継承は維持する
+        current->priority = mutex_priority(current);
+#else
         current->priority = priority;
+#endif
     }
     putcurrent();
     return old;
 }
 
-// メモリの確保をするシステムコール
-static void *thread_kmalloc(int size)
+// タイムスライスを変更するシステムコール
+static int thread_setslice(int priority, int ticks)
 {
+    int old;
+
     putcurrent();
-    return kzmem_alloc(size);
+    if (priority < 0 || priority >= PRIORITY_NUM || ticks < 0) {
+        return -1;
+    }
+    old = timeslice[priority];
+    timeslice[priority] = ticks;
+    return old;
 }
 
-// メモリの解放をするシステムコール
-static int thread_kmfree(char *p)
+#ifdef KZ_MUTEX
+// ミューテックスを生成するシステムコール
+static kz_mutex_id_t thread_mutex_create(void)
 {
-    kzmem_free(p);
+    int i;
+
     putcurrent();
-    return 0;
+    for (i = 0; i < MUTEX_NUM; i++) {
+        if (!mutexes[i].used) {
+            memset(&mutexes[i], 0, sizeof(mutexes[i]));
+            mutexes[i].used = 1;
+            return i;
+        }
+    }
+    return -1;
 }
 
-// メッセージの送信処理
-static void sendmsg(kz_msgbox *mboxp, kz_thread *thp, int size, char *p)
+// ミューテックスを獲得するシステムコール
+static int thread_mutex_lock(kz_mutex_id_t id)
 {
-    kz_msgbuf *mp;
-    // メッセージバッファを作成
-    mp = (kz_msgbuf *) kzmem_alloc(sizeof(*mp));
-    if (mp == NULL) {
-        kz_sysdown();
-    }
+    kz_mutex *mtxp = &mutexes[id];
+
+    if ((id < 0) || (id >= MUTEX_NUM) || !mtxp->used || (mtxp->owner == current)) {
+        putcurrent();
+        return -1;
+    }
+    if (mtxp->owner == NULL) {
+        // 空いているので獲得する
+        mtxp->owner = current;
+        mtxp->next = current->mutex;
+        current->mutex = mtxp;
+        putcurrent();
+        return 0;
+    }
+    // 所有スレッドが解放するまで待ち、所有スレッドには自分の優先度を継承させる
+    waitque_put(&mtxp->waitque, current);
+    mutex_inherit(mtxp, current->priority);
+    return 0;
+}
+
+// ミューテックスを解放するシステムコール
+static int thread_mutex_unlock(kz_mutex_id_t id)
+{
+    kz_mutex *mtxp = &mutexes[id];
+
+    if ((id < 0) || (id >= MUTEX_NUM) || !mtxp->used || (mtxp->owner != current)) {
+        putcurrent();
+        return -1;
+    }
+    mutex_release(mtxp);
+    // 継承していた優先度を戻す
+    current->priority = mutex_priority(current);
+    putcurrent();
+    return 0;
+}
+#endif
+
+#ifdef KZ_SEMFLAG
+// セマフォを生成するシステムコール
+static kz_sem_id_t thread_sem_create(int count)
+{
+    int i;
+
+    putcurrent();
+    if (count < 0) {
+        return -1;
+    }
+    for (i = 0; i < SEM_NUM; i++) {
+        if (!sems[i].used) {
+            memset(&sems[i], 0, sizeof(sems[i]));
+            sems[i].count = count;
+            sems[i].used = 1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// セマフォの資源を獲得するシステムコール
+static int thread_sem_wait(kz_sem_id_t id)
+{
+    kz_sem *semp = &sems[id];
+
+    if ((id < 0) || (id >= SEM_NUM) || !semp->used) {
+        putcurrent();
+        return -1;
+    }
+    if (semp->count > 0) {
+        semp->count--;
+        putcurrent();
+        return 0;
+    }
+    // 資源が返却されるまで待つ
+    waitque_put(&semp->waitque, current);
+    return 0;
+}
+
+// セマフォの資源を返却するシステムコール
+// 割り込みハンドラからはサービスコールとして呼び出せる
+static int thread_sem_post(kz_sem_id_t id)
+{
+    kz_sem *semp = &sems[id];
+    kz_thread *thp;
+
+    putcurrent();
+    if ((id < 0) || (id >= SEM_NUM) || !semp->used) {
+        return -1;
+    }
+    thp = waitque_get(&semp->waitque);
+    if (thp) {
+        // 待ちスレッドがいれば資源を直接渡して起床させる
+        current = thp;
+        putcurrent();
+    } else {
+        semp->count++;
+    }
+    return 0;
+}
+
+// イベントフラグを生成するシステムコール
+static kz_flag_id_t thread_flag_create(void)
+{
+    int i;
+
+    putcurrent();
+    for (i = 0; i < FLAG_NUM; i++) {
+        if (!eventflags[i].used) {
+            memset(&eventflags[i], 0, sizeof(eventflags[i]));
+            eventflags[i].used = 1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// イベントフラグの待ち条件が成立しているか調べ、成立していれば待ち解除の処理をする
+static int flag_check(kz_flag *flgp, kz_syscall_param_t *p)
+{
+    uint16 ptn = flgp->pattern & p->un.flag_wait.pattern;
+
+    if (!ptn || ((p->un.flag_wait.mode & KZ_FLAG_WAIT_AND) && (ptn != p->un.flag_wait.pattern))) {
+        return 0;
+    }
+    if (p->un.flag_wait.ptnp) {
+        *(p->un.flag_wait.ptnp) = flgp->pattern;
+    }
+    if (p->un.flag_wait.mode & KZ_FLAG_WAIT_CLEAR) {
+        flgp->pattern &= ~p->un.flag_wait.pattern;
+    }
+    return 1;
+}
+
+// イベントフラグのパターンを待つシステムコール
+static int thread_flag_wait(kz_flag_id_t id, uint16 pattern, int mode)
+{
+    kz_flag *flgp = &eventflags[id];
+
+    if ((id < 0) || (id >= FLAG_NUM) || !flgp->used || !pattern) {
+        putcurrent();
+        return -1;
+    }
+    if (flag_check(flgp, current->syscall.param)) {
+        putcurrent();
+        return 0;
+    }
+    // 条件が成立するまで待つ
+    waitque_put(&flgp->waitque, current);
+    return 0;
+}
+
+// イベントフラグのビットをセットするシステムコール
+// 割り込みハンドラからはサービスコールとして呼び出せる
+static int thread_flag_set(kz_flag_id_t id, uint16 pattern)
+{
+    kz_flag *flgp = &eventflags[id];
+    kz_thread *thp, *next;
+
+    putcurrent();
+    if ((id < 0) || (id >= FLAG_NUM) || !flgp->used) {
+        return -1;
+    }
+    flgp->pattern |= pattern;
+    // 条件が成立した待ちスレッドを優先度順に起床させる
+    for (thp = flgp->waitque.head; thp && flgp->pattern; thp = next) {
+        next = thp->next;
+        if (flag_check(flgp, thp->syscall.param)) {
+            waitque_remove(thp);
+            current = thp;
+            putcurrent();
+        }
+    }
+    return 0;
+}
+
+// イベントフラグのビットをクリアするシステムコール
+static int thread_flag_clear(kz_flag_id_t id, uint16 pattern)
+{
+    kz_flag *flgp = &eventflags[id];
+
+    putcurrent();
+    if ((id < 0) || (id >= FLAG_NUM) || !flgp->used) {
+        return -1;
+    }
+    flgp->pattern &= ~pattern;
+    return 0;
+}
+#endif
+
+// メモリの確保をするシステムコール
+// 空きが無ければNULLを返す
+static void *thread_kmalloc(int size)
+{
+    putcurrent();
+    return kmem_alloc(size, current);
+}
+
+// メモリを確保できるまで待つシステムコール
+// 要求サイズに合うメモリプールが無ければ待たずにNULLを返す
+static void *thread_kmalloc_wait(int size)
+{
+    void *p;
+
+    p = kmem_alloc(size, current);
+    if (p || (kzmem_class(size) < 0)) {
+        putcurrent();
+        return p;
+    }
+    // 同じサイズクラスのメモリが解放されるまでスリープさせる
+    waitque_put(&kmwaiters, current);
+    return NULL;
+}
+
+// メモリの解放をするシステムコール
+// 解放を待っているスレッドがいれば、確保できたスレッドを起こす
+static int thread_kmfree(char *p)
+{
+    kmem_free(p);
+    putcurrent();
+    kmem_wakeup();
+    return 0;
+}
+
+// メッセージの送信処理
+// MSGBUF_FLAG_COPIEDなら、ポインタではなくデータそのものをメッセージバッファにコピーする
+// 送信スレッドの優先度の帯の末尾につなぐ(割り込みからの送信は最も優先度の高い帯)
+// キューが満杯なら-1を返す
+static int sendmsg(kz_msgbox *mboxp, kz_thread *thp, int size, char *p, int flags)
+{
+    kz_msgbuf *mp;
+    int band;
+
+    if ((flags & MSGBUF_FLAG_COPIED) && ((size < 0) || (size > KZ_MSG_INLINE_SIZE))) {
+        return -1;
+    }
+    // 未使用のメッセージバッファを取り出す
+    // 1つのメッセージボックスがすべてを使い切らないよう、ボックスごとの上限を設ける
+    mp = freemsgbufs;
+    if ((mp == NULL) || (mboxp->count >= MSGBOX_MSGBUF_QUOTA)) {
+        return -1;
+    }
+    freemsgbufs = mp->next;
+    mboxp->count++;
     mp->next = NULL;
-    mp->sender = thp;
+    mp->sender = thp ? thp->id : 0;
     mp->param.size = size;
-    mp->param.p = p;
+    mp->param.flags = flags;
+    if (flags & MSGBUF_FLAG_COPIED) {
+        memcpy(mp->param.u.data, p, size);
+    } else {
+        // 送信したスレッドが受信前に終了しても回収されないようにする
+        kmem_chown(p, NULL);
+        mp->param.u.p = p;
+    }
     // メッセージボックスのキューの末尾にメッセージを追加
-    if (mboxp->tail) {
-        mboxp->tail->next = mp;
+    band = thp ? MSGBOX_BAND(thp->priority) : 0;
+    if (mboxp->bands[band].tail) {
+        mboxp->bands[band].tail->next = mp;
     } else {
-        mboxp->head = mp;
+        mboxp->bands[band].head = mp;
+        mboxp->bandmap |= 1 << band;
     }
-    mboxp->tail = mp;
+    mboxp->bands[band].tail = mp;
+    return 0;
 }
 
 // メッセージの受信処理
-static void recvmsg(kz_msgbox *mboxp)
+// キューの先頭のメッセージを受信待ちスレッドthpに渡す
+// コピーで送られたメッセージは受信側のバッファにコピーし、*ppにはそのバッファを返す
+// 受信側にバッファが無ければメモリプールから獲得してコピーし、ポインタのメッセージとして渡す
+// 獲得できなければメッセージはキューに残したまま-1を返す(受信するスレッドの状態は変えない)
+static int recvmsg(kz_msgbox_id_t id, kz_thread *thp)
 {
+    kz_msgbox *mboxp = &msgboxes[id];
     kz_msgbuf *mp;
     kz_syscall_param_t *p;
+    int *sizep;
+    char **pp;
+    char *buf = NULL;
+#ifdef KZ_MSG_CALL
+    kz_thread *sender;
+#endif
+    int band;
 
-    // キューの先頭からメッセージを取り出す
-    mp = mboxp->head;
-    mboxp->head = mp->next;
-    if (mboxp->head == NULL) {
-        mboxp->tail = NULL;
+    // メッセージを受信するスレッドのパラメータを取り出す
+    p = thp->syscall.param;
+#ifdef KZ_MSG_SELECT
+    if (thp->syscall.type == KZ_SYSCALL_TYPE_SELECT) {
+        sizep = p->un.select.sizep;
+        pp = p->un.select.pp;
+    } else
+#endif
+    {
+        sizep = p->un.recv.sizep;
+        pp = p->un.recv.pp;
+        buf = p->un.recv.buf;
+    }
+
+    // 最も優先度の高い帯のキューの先頭のメッセージを受信する
+    band = ffs(mboxp->bandmap) - 1;
+    mp = mboxp->bands[band].head;
+    if ((mp->param.flags & MSGBUF_FLAG_COPIED) && !buf && pp && (mp->param.size > 0)) {
+        buf = kmem_alloc(mp->param.size, thp);
+        if (buf == NULL) {
+            // メモリが解放されたらkmem_wakeup()で渡し直す
+            msgpending = 1;
+            return -1;
+        }
+    }
+    mboxp->bands[band].head = mp->next;
+    if (mboxp->bands[band].head == NULL) {
+        mboxp->bands[band].tail = NULL;
+        mboxp->bandmap &= ~(1 << band);
     }
     mp->next = NULL;
 
     // メッセージを受信するスレッドに渡すパラメータを設定する
-    p = mboxp->receiver->syscall.param;
-    p->un.recv.ret = (kz_thread_id_t)mp->sender;
-    if (p->un.recv.sizep) {
-        *(p->un.recv.sizep) = mp->param.size;
+#ifdef KZ_MSG_SELECT
+    if (thp->syscall.type == KZ_SYSCALL_TYPE_SELECT) {
+        p->un.select.ret = mp->sender;
+        if (p->un.select.idp) {
+            *(p->un.select.idp) = id;
+        }
+    } else
+#endif
+    {
+        p->un.recv.ret = mp->sender;
+    }
+    if (sizep) {
+        *sizep = mp->param.size;
     }
-    if (p->un.recv.pp) {
-        *(p->un.recv.pp) = mp->param.p;
+#ifdef KZ_MSG_CALL
+    // kz_call()の要求なら、受信されたことをクライアントに記録する(kz_reply()で確認する)
+    if (mp->param.flags & MSGBUF_FLAG_CALL) {
+        sender = thread_lookup(mp->sender);
+        if (sender) {
+            sender->flags |= KZ_THREAD_FLAG_RECEIVED;
+        }
+    }
+#endif
+    if (mp->param.flags & MSGBUF_FLAG_COPIED) {
+        if (buf) {
+            memcpy(buf, mp->param.u.data, mp->param.size);
+        }
+        if (pp) {
+            *pp = buf;
+        }
+    } else {
+        // メモリプールのブロックなら受信したスレッドの所有にする
+        kmem_chown(mp->param.u.p, thp);
+        if (pp) {
+            *pp = mp->param.u.p;
+        }
     }
-    mboxp->receiver = NULL;
-    // メッセージバッファを解放
-    kzmem_free(mp);
+    // メッセージバッファを未使用のリストに戻す
+    mboxp->count--;
+    mp->next = freemsgbufs;
+    freemsgbufs = mp;
+    return 0;
 }
 
-// メッセージを送信するシステムコール
-static int thread_send(kz_msgbox_id_t id, int size, char *p)
+// メッセージボックスの初期化
+static void msgbox_init(kz_msgbox *mboxp)
 {
-    kz_msgbox *mboxp = &msgboxes[id];
+    memset(mboxp, 0, sizeof(*mboxp));
+    mboxp->used = 1;
+}
 
-    putcurrent();
-    // メッセージを送信
-    sendmsg(mboxp, current, size, p);
-    // 受信待ちスレッドが存在している場合は受信処理を行う
-    if (mboxp->receiver) {
-        // 受信待ちスレッドをカレントにする
-        current = mboxp->receiver;
+// IDからメッセージボックスを求める(不正なIDならNULL)
+static kz_msgbox *msgbox_get(kz_msgbox_id_t id)
+{
+    if (((int)id < 0) || ((int)id >= MSGBOX_ID_NUM) || !msgboxes[id].used) {
+        return NULL;
+    }
+    return &msgboxes[id];
+}
+
+#ifdef KZ_MBOX_NAMED
+// 名前からメッセージボックスのIDを求める(見つからなければ-1)
+static kz_msgbox_id_t msgbox_find(char *name)
+{
+    int i;
+
+    for (i = 0; i < MSGBOX_ID_NUM; i++) {
+        if (msgboxes[i].used && !strcmp(msgboxes[i].name, name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+#endif
+
+// メッセージボックスidを待っているスレッドのうち、最も優先度の高いものを返す
+// 受信待ちのスレッドとkz_select()で待っているスレッドの両方から探す
+static kz_thread *msgbox_receiver(kz_msgbox_id_t id)
+{
+    kz_thread *thp = msgboxes[id].receivers.head;
+#ifdef KZ_MSG_SELECT
+    kz_thread *sthp;
+
+    for (sthp = selectors.head; sthp; sthp = sthp->next) {
+        if (sthp->syscall.param->un.select.mask & KZ_MSGBOX_MASK(id)) {
+            break;
+        }
+    }
+    // 同じ優先度なら受信待ちのスレッドを優先する
+    if (sthp && (!thp || sthp->priority < thp->priority)) {
+        thp = sthp;
+    }
+#endif
+    return thp;
+}
+
+// メッセージボックスidにたまっているメッセージを受信待ちスレッドに渡す
+// 受信待ちスレッドが存在している場合は、優先度の高いスレッドから順に受信処理を行う
+static void msgbox_deliver(kz_msgbox_id_t id)
+{
+    kz_thread *thp;
+
+    while (msgboxes[id].bandmap && (thp = msgbox_receiver(id)) != NULL) {
         // 受信処理をする
-        recvmsg(mboxp);
+        if (recvmsg(id, thp) < 0) {
+            // メモリが足りずに受け取れないので、解放されるまで受信待ちのままにしておく
+            break;
+        }
+        waitque_remove(thp);
+        // タイムアウト待ちを解除する
+        timerque_remove(thp);
         // 受信が済んだらブロック解除
+        current = thp;
         putcurrent();
     }
+}
+
+// メッセージを送信するシステムコール
+// copiedが真ならポインタではなくデータをメッセージにコピーして送る(kz_sendi())
+// メッセージボックスのキューが満杯なら-1を返す
+static int thread_send(kz_msgbox_id_t id, int size, char *p, int copied)
+{
+    kz_msgbox *mboxp = msgbox_get(id);
+
+    putcurrent();
+    // メッセージを送信
+    if ((mboxp == NULL) || (sendmsg(mboxp, current, size, p, copied ? MSGBUF_FLAG_COPIED : 0) < 0)) {
+        return -1;
+    }
+    msgbox_deliver(id);
     return size;
 }
 
-// メッセージを受信するシステムコール
-static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp)
+#ifdef KZ_MSG_SENDV
+// 複数のメッセージをまとめて送信するシステムコール
+// すべてキューにつないでから受信待ちスレッドを起こすので、カーネルへの突入は1回で済む
+// 送信できたメッセージの数を返す(失敗したところで打ち切る)
+static int thread_sendv(kz_msgvec_t *vec, int num)
 {
-    kz_msgbox *mboxp = &msgboxes[id];
+    kz_msgbox *mboxp;
+    int i, n;
 
-    if (mboxp->receiver) {
-        kz_sysdown();
+    putcurrent();
+    for (n = 0; n < num; n++) {
+        mboxp = msgbox_get(vec[n].id);
+        if ((mboxp == NULL) || (sendmsg(mboxp, current, vec[n].size, vec[n].p, 0) < 0)) {
+            break;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        msgbox_deliver(vec[i].id);
     }
-    // 受信待ちスレッドを設定
-    mboxp->receiver = current;
+    return n;
+}
+#endif
 
-    if (mboxp->head == NULL) {
-        // メッセージボックスにメッセージが無いので、スレッドをスリープさせる
+// メッセージを受信するシステムコール
+// timeoutが0なら待たずに、正ならtimeoutティック待っても受信できなければ-1を返す
+static kz_thread_id_t thread_recv(kz_msgbox_id_t id, int *sizep, char **pp, int timeout)
+{
+    kz_msgbox *mboxp = msgbox_get(id);
+
+    if (mboxp == NULL) {
+        putcurrent();
         return -1;
     }
     // メッセージを受信
-    recvmsg(mboxp);
-    // スレッドをキューに戻す
+    if (mboxp->bandmap && (recvmsg(id, current) == 0)) {
+        // スレッドをキューに戻す
+        putcurrent();
+        return current->syscall.param->un.recv.ret;
+    }
+    if (timeout == 0) {
+        // 待たずに戻る
+        putcurrent();
+        return -1;
+    }
+    if (timeout > 0) {
+        timerque_put(current, timeout);
+    }
+    // メッセージボックスにメッセージが無い(またはメモリ不足で受け取れない)ので、受信待ちスレッドとしてスリープさせる
+    // 複数のスレッドが待っている場合は優先度の高い順に受信する
+    waitque_put(&mboxp->receivers, current);
+    return -1;
+}
+
+#ifdef KZ_MSG_SELECT
+// 複数のメッセージボックスのいずれかからメッセージを受信するシステムコール
+// maskにセットされたメッセージボックスを若い番号から調べ、どれも空なら受信できるまで待つ
+static kz_thread_id_t thread_select(uint32 mask, kz_msgbox_id_t *idp, int *sizep, char **pp)
+{
+    int i;
+
+    for (i = 0; i < MSGBOX_ID_NUM; i++) {
+        if ((mask & KZ_MSGBOX_MASK(i)) && msgboxes[i].bandmap && (recvmsg(i, current) == 0)) {
+            putcurrent();
+            return current->syscall.param->un.select.ret;
+        }
+    }
+    if ((mask & (KZ_MSGBOX_MASK(MSGBOX_ID_NUM) - 1)) == 0) {
+        // 待つメッセージボックスが無い
+        putcurrent();
+        return -1;
+    }
+    // いずれかのメッセージボックスに送信されるまでスリープさせる
+    waitque_put(&selectors, current);
+    return -1;
+}
+#endif
+
+#ifdef KZ_MSG_CALL
+// 要求を送信して応答を待つシステムコール
+// 受信待ちのサーバスレッドがいれば、その場で要求を渡してサーバに直接切り替える
+static int thread_call(kz_msgbox_id_t id, int size, char *p)
+{
+    kz_msgbox *mboxp = msgbox_get(id);
+    kz_thread *thp;
+    int empty;
+
+    // 要求を送信(送信元はカレントスレッド)
+    current->flags &= ~KZ_THREAD_FLAG_RECEIVED;
+    if (mboxp == NULL) {
+        putcurrent();
+        return -1;
+    }
+    empty = !mboxp->bandmap;
+    if (sendmsg(mboxp, current, size, p, MSGBUF_FLAG_CALL) < 0) {
+        putcurrent();
+        return -1;
+    }
+    // 直接渡すのは、キューにあるのがこの要求だけの場合に限る
+    // (先に残っているメッセージがあれば、通常の送信と同じく順に受信される)
+    thp = empty ? msgbox_receiver(id) : NULL;
+    if (thp && (recvmsg(id, thp) == 0)) {
+        waitque_remove(thp);
+        timerque_remove(thp);
+        // 同じ優先度のスレッドより先にサーバを動作させる
+        current = thp;
+        putcurrent_head();
+    }
+    // kz_reply()で応答されるまでスリープさせる
+    return -1;
+}
+
+// kz_call()で応答を待っているスレッドidに応答を返すシステムコール
+// 応答はメッセージボックスを経由せず、待っているスレッドに直接渡す
+static int thread_reply(kz_thread_id_t id, int size, char *p)
+{
+    kz_thread *thp;
+    kz_syscall_param_t *param;
+
+    putcurrent();
+    thp = thread_lookup(id);
+    if ((thp == NULL) || (thp->flags & KZ_THREAD_FLAG_READY) || (thp->syscall.type != KZ_SYSCALL_TYPE_CALL)) {
+        // 応答を待っていない
+        return -1;
+    }
+    if (!(thp->flags & KZ_THREAD_FLAG_RECEIVED)) {
+        // 要求がまだメッセージボックスにあり、サーバに受信されていない
+        return -1;
+    }
+    thp->flags &= ~KZ_THREAD_FLAG_RECEIVED;
+    param = thp->syscall.param;
+    if (param->un.call.rsizep) {
+        *(param->un.call.rsizep) = size;
+    }
+    if (param->un.call.rpp) {
+        *(param->un.call.rpp) = p;
+    }
+    param->un.call.ret = 0;
+    kmem_chown(p, thp);
+    // 同じ優先度ならサーバより先にクライアントを動作させる
+    current = thp;
+    putcurrent_head();
+    return 0;
+}
+#endif
+
+#ifdef KZ_MBOX_NAMED
+// 名前を付けてメッセージボックスを生成するシステムコール
+// 同じ名前のメッセージボックスがある場合や空きが無い場合は-1を返す
+static kz_msgbox_id_t thread_mbox_create(char *name)
+{
+    int i;
+
     putcurrent();
+    if ((name == NULL) || (strlen(name) > MSGBOX_NAME_SIZE) || (msgbox_find(name) >= 0)) {
+        return -1;
+    }
+    for (i = MSGBOX_ID_STATIC_NUM; i < MSGBOX_ID_NUM; i++) {
+        if (!msgboxes[i].used) {
+            msgbox_init(&msgboxes[i]);
+            strcpy(msgboxes[i].name, name);
+            return i;
+        }
+    }
+    return -1;
+}
 
-    return current->syscall.param->un.recv.ret;
+// 名前からメッセージボックスのIDを求めるシステムコール
+static kz_msgbox_id_t thread_mbox_lookup(char *name)
+{
+    putcurrent();
+    if (name == NULL) {
+        return -1;
+    }
+    return msgbox_find(name);
 }
+#endif
 
 
 // 割り込みハンドラの登録
@@ -387,11 +1684,59 @@ static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *param)
             param->un.wait.ret = thread_wait();
             break;
         case KZ_SYSCALL_TYPE_SLEEP:
-            param->un.sleep.ret = thread_sleep();
+            param->un.sleep.ret = thread_sleep(param->un.sleep.timeout);
+            break;
+        case KZ_SYSCALL_TYPE_DELAY:
+            param->un.delay.ret = thread_delay(param->un.delay.ticks);
+            break;
+#ifdef KZ_MUTEX
+        case KZ_SYSCALL_TYPE_MUTEX_CREATE:
+            param->un.mutex_create.ret = thread_mutex_create();
+            break;
+        case KZ_SYSCALL_TYPE_MUTEX_LOCK:
+            param->un.mutex_lock.ret = thread_mutex_lock(param->un.mutex_lock.id);
+            break;
+        case KZ_SYSCALL_TYPE_MUTEX_UNLOCK:
+            param->un.mutex_unlock.ret = thread_mutex_unlock(param->un.mutex_unlock.id);
+            break;
+#endif
+#ifdef KZ_SEMFLAG
+        case KZ_SYSCALL_TYPE_SEM_CREATE:
+            param->un.sem_create.ret = thread_sem_create(param->un.sem_create.count);
+            break;
+        case KZ_SYSCALL_TYPE_SEM_WAIT:
+            param->un.sem_wait.ret = thread_sem_wait(param->un.sem_wait.id);
+            break;
+        case KZ_SYSCALL_TYPE_SEM_POST:
+            param->un.sem_post.ret = thread_sem_post(param->un.sem_post.id);
             break;
+        case KZ_SYSCALL_TYPE_FLAG_CREATE:
+            param->un.flag_create.ret = thread_flag_create();
+            break;
+        case KZ_SYSCALL_TYPE_FLAG_WAIT:
+            param->un.flag_wait.ret = thread_flag_wait(param->un.flag_wait.id, param->un.flag_wait.pattern,
+                                                       param->un.flag_wait.mode);
+            break;
+        case KZ_SYSCALL_TYPE_FLAG_SET:
+            param->un.flag_set.ret = thread_flag_set(param->un.flag_set.id, param->un.flag_set.pattern);
+            break;
+        case KZ_SYSCALL_TYPE_FLAG_CLEAR:
+            param->un.flag_clear.ret = thread_flag_clear(param->un.flag_clear.id, param->un.flag_clear.pattern);
+            break;
+#endif
         case KZ_SYSCALL_TYPE_WAKEUP:
             param->un.wakeup.ret = thread_wakeup(param->un.wakeup.id);
             break;
+#ifdef KZ_STACK_WATERMARK
+        case KZ_SYSCALL_TYPE_STACKFREE:
+            param->un.stackfree.ret = thread_stackfree(param->un.stackfree.id);
+            break;
+#endif
+#ifdef KZ_THREAD_STAT
+        case KZ_SYSCALL_TYPE_GETSTAT:
+            param->un.getstat.ret = thread_getstat(param->un.getstat.id, param->un.getstat.stat);
+            break;
+#endif
         case KZ_SYSCALL_TYPE_GETID:
             param->un.getid.ret = thread_getid();
             break;
@@ -401,18 +1746,55 @@ static void call_functions(kz_syscall_type_t type, kz_syscall_param_t *param)
         case KZ_SYSCALL_TYPE_KMALLOC:
             param->un.kmalloc.ret = thread_kmalloc(param->un.kmalloc.size);
             break;
+        case KZ_SYSCALL_TYPE_KMALLOC_WAIT:
+            param->un.kmalloc.ret = thread_kmalloc_wait(param->un.kmalloc.size);
+            break;
         case KZ_SYSCALL_TYPE_KMFREE:
             param->un.kmfree.ret = thread_kmfree(param->un.kmfree.p);
             break;
         case KZ_SYSCALL_TYPE_SEND:
-            param->un.send.ret = thread_send(param->un.send.id, param->un.send.size, param->un.send.p);
+            param->un.send.ret = thread_send(param->un.send.id, param->un.send.size, param->un.send.p, 0);
+            break;
+        case KZ_SYSCALL_TYPE_SENDI:
+            param->un.send.ret = thread_send(param->un.send.id, param->un.send.size, param->un.send.p, 1);
+            break;
+#ifdef KZ_MSG_SENDV
+        case KZ_SYSCALL_TYPE_SENDV:
+            param->un.sendv.ret = thread_sendv(param->un.sendv.vec, param->un.sendv.num);
             break;
+#endif
         case KZ_SYSCALL_TYPE_RECV:
-            param->un.recv.ret = thread_recv(param->un.recv.id, param->un.recv.sizep, param->un.recv.pp);
+            param->un.recv.ret = thread_recv(param->un.recv.id, param->un.recv.sizep, param->un.recv.pp,
+                                             param->un.recv.timeout);
+            break;
+#ifdef KZ_MSG_SELECT
+        case KZ_SYSCALL_TYPE_SELECT:
+            param->un.select.ret = thread_select(param->un.select.mask, param->un.select.idp,
+                                                 param->un.select.sizep, param->un.select.pp);
+            break;
+#endif
+#ifdef KZ_MSG_CALL
+        case KZ_SYSCALL_TYPE_CALL:
+            param->un.call.ret = thread_call(param->un.call.id, param->un.call.size, param->un.call.p);
             break;
+        case KZ_SYSCALL_TYPE_REPLY:
+            param->un.reply.ret = thread_reply(param->un.reply.id, param->un.reply.size, param->un.reply.p);
+            break;
+#endif
+#ifdef KZ_MBOX_NAMED
+        case KZ_SYSCALL_TYPE_MBOX_CREATE:
+            param->un.mbox_create.ret = thread_mbox_create(param->un.mbox_create.name);
+            break;
+        case KZ_SYSCALL_TYPE_MBOX_LOOKUP:
+            param->un.mbox_lookup.ret = thread_mbox_lookup(param->un.mbox_lookup.name);
+            break;
+#endif
         case KZ_SYSCALL_TYPE_SETINTR:
             param->un.setintr.ret = thread_setintr(param->un.setintr.type, param->un.setintr.handler);
             break;
+        case KZ_SYSCALL_TYPE_SETSLICE:
+            param->un.setslice.ret = thread_setslice(param->un.setslice.priority, param->un.setslice.ticks);
+            break;
         default:
             break;
     }
@@ -427,6 +1809,46 @@ static void syscall_proc(kz_syscall_type_t type, kz_syscall_param_t *param)
     call_functions(type, param);
 }
 
+// スケジューリングに影響しないシステムコールか?
+// 呼び出し元をブロックせず、他のスレッドも起床させないものはキュー操作もディスパッチもせずに戻れる
+static int syscall_is_fast(kz_syscall_type_t type, kz_syscall_param_t *param)
+{
+    switch (type) {
+        case KZ_SYSCALL_TYPE_GETID:
+#ifdef KZ_THREAD_STAT
+        case KZ_SYSCALL_TYPE_GETSTAT:
+#endif
+#ifdef KZ_STACK_WATERMARK
+        case KZ_SYSCALL_TYPE_STACKFREE:
+#endif
+        case KZ_SYSCALL_TYPE_SETSLICE:
+        case KZ_SYSCALL_TYPE_SETINTR:
+        case KZ_SYSCALL_TYPE_KMALLOC:
+#ifdef KZ_MUTEX
+        case KZ_SYSCALL_TYPE_MUTEX_CREATE:
+#endif
+#ifdef KZ_SEMFLAG
+        case KZ_SYSCALL_TYPE_SEM_CREATE:
+        case KZ_SYSCALL_TYPE_FLAG_CREATE:
+        case KZ_SYSCALL_TYPE_FLAG_CLEAR:
+#endif
+#ifdef KZ_MBOX_NAMED
+        case KZ_SYSCALL_TYPE_MBOX_CREATE:
+        case KZ_SYSCALL_TYPE_MBOX_LOOKUP:
+#endif
+            return 1;
+        case KZ_SYSCALL_TYPE_KMFREE:
+            // 解放を待っているスレッドやメッセージが無い場合のみ
+            return (kmwaiters.head == NULL) && !msgpending;
+        case KZ_SYSCALL_TYPE_CHPRI:
+            // 優先度が変わらない場合のみ
+            return (param->un.chpri.priority < 0) || (param->un.chpri.priority == current->basepri);
+        default:
+            break;
+    }
+    return 0;
+}
+
 // サービスコールの処理
 static void srvcall_proc(kz_syscall_type_t type, kz_syscall_param_t *param)
 {
@@ -438,16 +1860,13 @@ static void srvcall_proc(kz_syscall_type_t type, kz_syscall_param_t *param)
 static void schedule(void)
 {
     int i;
-    // スレッドのキューを優先度の高い順に動作可能なスレッドを検索する
-    for (i = 0; i < PRIORITY_NUM; i++) {
-        if (readyque[i].head) {
-            break;
-        }
-    }
-    if (i == PRIORITY_NUM) {
-        // スレッドのキューが満杯
+    // 動作可能なスレッドが無い
+    if (!readygrp) {
         kz_sysdown();
     }
+    // ビットマップから最も優先度の高いキューを求める
+    i = ffs(readygrp) - 1;
+    i = (i << 4) + ffs(readymap[i]) - 1;
     // 先頭のスレッドをスケジュールする
     current = readyque[i].head;
 }
@@ -468,18 +1887,179 @@ static void softerr_intr(void)
     thread_exit();
 }
 
+// 経過したティック数の反映
+static void tick_proc(int ticks)
+{
+    // 実行中のスレッドが強制終了された直後なら、ティックを加算するスレッドはいない
+    if (current) {
+#ifdef KZ_THREAD_STAT
+        // 実行中のスレッドの実行時間に加算する
+        current->stat.ticks += ticks;
+#endif
+        // タイムスライスを使い切ったら同じ優先度のキューの末尾に回す
+        if (current->slice > 0) {
+            current->slice -= ticks;
+            if (current->slice <= 0) {
+                getcurrent();
+                putcurrent();
+            }
+        }
+    }
+    // タイムアウトしたスレッドを起床させる
+    timerque_tick(ticks);
+}
+
+// タイマ割り込みの処理
+static void tmrintr(void)
+{
+    if (!timer_is_expired(TIMER_DEFAULT_DEVICE)) {
+        // ティックレス動作からの復帰時に処理済み
+        return;
+    }
+    timer_expire(TIMER_DEFAULT_DEVICE);
+    tick_proc(1);
+}
+
+#ifdef KZ_TICKLESS
+// アイドルスレッドだけが動作可能か?
+static int idle_only(void)
+{
+    int i = PRIORITY_MAP_INDEX(current->priority);
+
+    return (current == idle) && !current->next &&
+           (readygrp == (1U << i)) && (readymap[i] == PRIORITY_MAP_BIT(current->priority));
+}
+
+// ティックレス動作の開始
+// 次のタイムアウトまでタイマの周期を延ばし、その間のティック割り込みを止める
+static void tickless_enter(void)
+{
+    int ticks = TICKLESS_MAX;
+
+    if (timerque && timerque->timer.delta < ticks) {
+        ticks = timerque->timer.delta;
+    }
+    // 処理中のティックが残っていれば先に処理させる
+    if (ticks <= 1 || timer_is_expired(TIMER_DEFAULT_DEVICE)) {
+        return;
+    }
+    // カウンタは現在のティックの途中から続けて数える
+    timer_setperiod(TIMER_DEFAULT_DEVICE, (unsigned int)ticks * TICK_COUNT);
+    tickless = ticks;
+}
+
+// ティックレス動作の終了
+// 実際に経過したティック数を反映し、端数を残したまま周期動作に戻す
+static int tickless_exit(void)
+{
+    kz_thread *thp = current;
+    int expired, ticks = 0;
+    uint16 count;
+
+    expired = timer_is_expired(TIMER_DEFAULT_DEVICE);
+    count = timer_gettime(TIMER_DEFAULT_DEVICE);
+    if (!expired && timer_is_expired(TIMER_DEFAULT_DEVICE)) {
+        // 読み出しの間に満了した
+        expired = 1;
+        count = timer_gettime(TIMER_DEFAULT_DEVICE);
+    }
+    if (expired) {
+        // 満了時にカウンタはクリアされている
+        timer_expire(TIMER_DEFAULT_DEVICE);
+        ticks = tickless;
+    }
+    // 除算を使わずにティック数と端数を求める(高々TICKLESS_MAX回)
+    while (count >= TICK_COUNT) {
+        count -= TICK_COUNT;
+        ticks++;
+    }
+    if (count > TICK_COUNT - TICKLESS_MARGIN) {
+        ticks++;
+        count = 0;
+    }
+    timer_settime(TIMER_DEFAULT_DEVICE, count);
+    timer_setperiod(TIMER_DEFAULT_DEVICE, TICK_COUNT);
+    tickless = 0;
+
+    if (ticks) {
+        tick_proc(ticks);
+    }
+    // 割り込みの処理は割り込まれたスレッドで続ける
+    current = thp;
+    return ticks;
+}
+#endif
+
 // 割り込み処理の入口関数
 static void thread_intr(softvec_type_t type, unsigned long sp)
 {
+#ifdef KZ_THREAD_STAT
+    kz_thread *prev = current;
+#endif
+    int ticked = 0;
+
     // カレントスレッドのコンテキストを保存
     current->context.sp = sp;
+#ifdef KZ_THREAD_STAT
+    if (type == SOFTVEC_TYPE_SYSCALL) {
+        current->stat.syscall++;
+    }
+#endif
+
+#ifdef KZ_TICKLESS
+    if (tickless) {
+        // ティックを反映するとタイムアウトしたスレッドが動作可能になりうる
+        ticked = tickless_exit();
+    }
+#endif
+
+    // スタックあふれしたスレッドは強制終了する
+    if (stack_overflow(current, sp)) {
+        puts(current->name);
+        puts(" STACK OVERFLOW.\n");
+        getcurrent();
+        thread_exit();
+        // 解放したTCBや、thread_exit()で起床したスレッドをカレントとして扱わないようにする
+        current = NULL;
+        // スレッドの要求は処理せず、デバイスの割り込みだけ処理する
+        if ((type == SOFTVEC_TYPE_SYSCALL) || (type == SOFTVEC_TYPE_SOFTERR)) {
+            type = -1;
+        }
+    }
+
+    // スケジューリングに影響しないシステムコールは、実行中のスレッドをキューに残したまま処理して
+    // そのまま呼び出し元に戻る(割り込みの出口でレジスタを復旧してスレッドに復帰する)
+    // 止めていたティックを反映した場合は、起床したスレッドがいるかもしれないのでスケジューリングする
+    if ((type == SOFTVEC_TYPE_SYSCALL) && !ticked && syscall_is_fast(current->syscall.type, current->syscall.param)) {
+        call_functions(current->syscall.type, current->syscall.param);
+        return;
+    }
 
     // 割り込みごとの処理を実行する
-    if (handlers[type]) {
+    if ((type >= 0) && handlers[type]) {
         handlers[type]();
     }
     // 次に動作するスレッドをスケジューリング
     schedule();
+#ifdef KZ_TICKLESS
+    if (idle_only()) {
+        tickless_enter();
+    }
+#endif
+#ifdef KZ_THREAD_STAT
+    // スレッドが切り替わる場合は統計情報を更新する
+    if (current != prev) {
+        current->stat.dispatch++;
+        if (prev->id) {
+            // 動作可能なまま切り替えられたら横取り、待ちに入ったなら自発的とみなす
+            if (prev->flags & KZ_THREAD_FLAG_READY) {
+                prev->stat.involuntary++;
+            } else {
+                prev->stat.voluntary++;
+            }
+        }
+    }
+#endif
     // スケジューリングされたスレッドをディスパッチ
     dispatch(&current->context);
 }
@@ -487,20 +2067,72 @@ static void thread_intr(softvec_type_t type, unsigned long sp)
 // 初期スレッドを起動しOSの動作を開始
 void kz_start(kz_func_t func, char *name, int priority, int stacksize, int argc, char *argv[])
 {
+    int i;
+    extern char userstack;
+
     // 動的メモリの初期化
     kzmem_init();
 
     current = NULL;
+    timerque = NULL;
+#ifdef KZ_TICKLESS
+    tickless = 0;
+#endif
     // 各種データの初期化
     memset(readyque, 0, sizeof(readyque));
+    readygrp = 0;
+    memset(readymap, 0, sizeof(readymap));
     memset(threads, 0, sizeof(threads));
+    // スタック領域の初期化
+    stackarea = &userstack;
+    for (i = 0; i < STACK_POOL_NUM; i++) {
+        stackpool[i].free = NULL;
+    }
+    // すべてのTCBを未使用のリストにつなげる
+    freethreads = NULL;
+    for (i = THREAD_NUM - 1; i >= 0; i--) {
+        threads[i].gen = 1;
+        threads[i].index = i;
+        threads[i].next = freethreads;
+        freethreads = &threads[i];
+    }
     memset(handlers, 0, sizeof(handlers));
+    // 静的なメッセージボックスは名前を付けて生成済みにしておく
+    freemsgbufs = NULL;
+    for (i = 0; i < MSGBUF_NUM; i++) {
+        msgbufs[i].next = freemsgbufs;
+        freemsgbufs = &msgbufs[i];
+    }
     memset(msgboxes, 0, sizeof(msgboxes));
+    for (i = 0; i < MSGBOX_ID_STATIC_NUM; i++) {
+        msgbox_init(&msgboxes[i]);
+#ifdef KZ_MBOX_NAMED
+        strcpy(msgboxes[i].name, msgbox_names[i]);
+#endif
+    }
+#ifdef KZ_MUTEX
+    memset(mutexes, 0, sizeof(mutexes));
+#endif
+#ifdef KZ_SEMFLAG
+    memset(sems, 0, sizeof(sems));
+    memset(eventflags, 0, sizeof(eventflags));
+#endif
+    for (i = 0; i < PRIORITY_NUM; i++) {
+        timeslice[i] = TIMESLICE_DEFAULT;
+    }
     // 割り込みハンドラの登録
     thread_setintr(SOFTVEC_TYPE_SYSCALL, syscall_intr);
     thread_setintr(SOFTVEC_TYPE_SOFTERR, softerr_intr);
+    thread_setintr(SOFTVEC_TYPE_TIMINTR, tmrintr);
+    // システムタイマの開始
+    timer_init(TIMER_DEFAULT_DEVICE);
+    timer_start(TIMER_DEFAULT_DEVICE, TICK_COUNT);
     // 初期スレッドを生成
-    current = (kz_thread *)thread_run(func, name, priority, stacksize, argc, argv);
+    current = thread_lookup(thread_run(func, name, priority, stacksize, argc, argv));
+    idle = current;
+#ifdef KZ_THREAD_STAT
+    current->stat.dispatch++;
+#endif
     // スレッドを起動
     dispatch(&current->context);
 }
@@ -29,16 +29,65 @@ int kz_wakeup(kz_thread_id_t id);
 kz_thread_id_t kz_getid(void);
 int kz_chpri(int priority);
 void *kz_kmalloc(int size);
+void *kz_kmalloc_wait(int size);
 int kz_kmfree(void *p);
 int kz_send(kz_msgbox_id_t id, int size, char *p);
+int kz_sendi(kz_msgbox_id_t id, int size, char *p);
+#ifdef KZ_MSG_SENDV
+int kz_sendv(kz_msgvec_t *vec, int num);
+#endif
+// kz_sendi()のメッセージをバッファ無しで受信すると、本体はメモリプールにコピーして渡される(kz_kmfree()で解放する)
 kz_thread_id_t kz_recv(kz_msgbox_id_t id, int *sizep, char **pp);
+// bufはKZ_MSG_INLINE_SIZEバイト以上の領域とする(kz_sendi()のメッセージはここにコピーされ、*ppはbufになる)
+kz_thread_id_t kz_recvbuf(kz_msgbox_id_t id, int *sizep, char **pp, char *buf);
+kz_thread_id_t kz_tryrecv(kz_msgbox_id_t id, int *sizep, char **pp);
+kz_thread_id_t kz_recv_timeout(kz_msgbox_id_t id, int timeout, int *sizep, char **pp);
+#ifdef KZ_MSG_SELECT
+kz_thread_id_t kz_select(uint32 mask, kz_msgbox_id_t *idp, int *sizep, char **pp);
+#endif
+#ifdef KZ_MSG_CALL
+int kz_call(kz_msgbox_id_t id, int size, char *p, int *rsizep, char **rpp);
+int kz_reply(kz_thread_id_t id, int size, char *p);
+#endif
+#ifdef KZ_MBOX_NAMED
+kz_msgbox_id_t kz_mbox_create(char *name);
+kz_msgbox_id_t kz_mbox_lookup(char *name);
+#endif
 int kz_setintr(softvec_type_t type, kz_handler_t handler);
+int kz_setslice(int priority, int ticks);
+int kz_tsleep(int timeout);
+int kz_delay(int ticks);
+#ifdef KZ_MUTEX
+kz_mutex_id_t kz_mutex_create(void);
+int kz_mutex_lock(kz_mutex_id_t id);
+int kz_mutex_unlock(kz_mutex_id_t id);
+#endif
+#ifdef KZ_SEMFLAG
+kz_sem_id_t kz_sem_create(int count);
+int kz_sem_wait(kz_sem_id_t id);
+int kz_sem_post(kz_sem_id_t id);
+kz_flag_id_t kz_flag_create(void);
+int kz_flag_wait(kz_flag_id_t id, uint16 pattern, int mode, uint16 *ptnp);
+int kz_flag_set(kz_flag_id_t id, uint16 pattern);
+int kz_flag_clear(kz_flag_id_t id, uint16 pattern);
+#endif
+#ifdef KZ_STACK_WATERMARK
+int kz_stackfree(kz_thread_id_t id);
+#endif
+#ifdef KZ_THREAD_STAT
+int kz_getstat(kz_thread_id_t id, kz_thread_stat_t *stat);
+#endif
 
 // STEP12
 int kx_wakeup(kz_thread_id_t id);
 void *kx_kmalloc(int size);
 int kx_kmfree(void *p);
 int kx_send(kz_msgbox_id_t id, int size, char *p);
+int kx_sendi(kz_msgbox_id_t id, int size, char *p);
+#ifdef KZ_SEMFLAG
+int kx_sem_post(kz_sem_id_t id);
+int kx_flag_set(kz_flag_id_t id, uint16 pattern);
+#endif
 
 int consdrv_main(int argc, char *argv[]);
 
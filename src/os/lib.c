@@ -95,6 +95,50 @@ int strncmp(const char *s1, const char *s2, int len)
     return 0;
 }
 
+// 最下位のセットされたビットの位置を返す(1始まり、ビットが無ければ0)
+// 4ビット単位のテーブル引きで、値によらず一定時間で求める
+int ffs(int i)
+{
+    static const unsigned char table[16] = {
+            0, 1, 2, 1, 3, 1, 2, 1, 4, 1, 2, 1, 3, 1, 2, 1,
+    };
+    uint16 x = i;
+
+    if (x & 0x00ff) {
+        if (x & 0x000f) {
+            return table[x & 0xf];
+        }
+        return table[(x >> 4) & 0xf] + 4;
+    }
+    if (x & 0x0f00) {
+        return table[(x >> 8) & 0xf] + 8;
+    }
+    if (x & 0xf000) {
+        return table[(x >> 12) & 0xf] + 12;
+    }
+    return 0;
+}
+
+// 最上位のセットされたビットの位置を返す(1始まり、ビットが無ければ0)
+int fls(int i)
+{
+    static const unsigned char table[16] = {
+            0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4,
+    };
+    uint16 x = i;
+
+    if (x & 0xff00) {
+        if (x & 0xf000) {
+            return table[(x >> 12) & 0xf] + 12;
+        }
+        return table[(x >> 8) & 0xf] + 8;
+    }
+    if (x & 0x00f0) {
+        return table[(x >> 4) & 0xf] + 4;
+    }
+    return table[x & 0xf];
+}
+
 int putxval(unsigned long value, int column)
 {
     char buf[9];
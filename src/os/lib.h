@@ -8,6 +8,8 @@ int strlen(const char *s);
 char *strcpy(char *dst, const char *src);
 int strcmp(const char *s1, const char *s2);
 int strncmp(const char *s1, const char *s2, int len);
+int ffs(int i);
+int fls(int i);
 
 int putc(unsigned char c);
 unsigned char getc(void);
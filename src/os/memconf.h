@@ -0,0 +1,24 @@
+#ifndef _KOZOS_MEMCONF_H_INCLUDED_
+#define _KOZOS_MEMCONF_H_INCLUDED_
+
+// メモリプールの構成
+// KZMEM_POOL(ブロックサイズ, 個数)をブロックサイズの小さい順に並べる
+// ブロックサイズはヘッダを含み、16の倍数でKZMEM_BLOCK_MAX以下にする
+// 領域はリンク時に確保され、_freeareaからuserstackまでに収まらなければリンクエラーになる
+#define KZMEM_POOLS \
+    KZMEM_POOL(16, 8) \
+    KZMEM_POOL(32, 8) \
+    KZMEM_POOL(64, 4)
+
+// 最大のブロックサイズ
+#define KZMEM_BLOCK_MAX 64
+
+// KZMEM_BLOCK_MAXに収まらない要求に使う可変長アロケータ(TLSF)の領域サイズ
+// 4の倍数で、0なら使わない
+// RAM(0x33e0バイト)に余裕が無いので標準では使わない(0x800程度を設定するとコードと合わせて3KBほど増える)
+#define KZMEM_TLSF_SIZE 0
+
+// 定義すると、userstackまでの残りの領域をすべて最大のブロックサイズのプールに割り当てる
+//#define KZMEM_ABSORB_REST
+
+#endif
@@ -2,12 +2,14 @@
 #include "kozos.h"
 #include "lib.h"
 #include "memory.h"
+#include "memconf.h"
 
 // メモリブロック構造体
 // メモリ領域の先頭に付加されるヘッダ
 typedef struct _kzmem_block {
     struct _kzmem_block *next;
-    int size;
+    uint8 owner;    // 確保したスレッド(0ならカーネルや割り込み)
+    uint8 pool;     // 所属するメモリプールの番号(解放済みならKZMEM_POOL_NONE)
 } kzmem_block;
 
 // メモリプール構造体
@@ -15,39 +17,294 @@ typedef struct _kzmem_pool {
     int size;
     int num;
     kzmem_block *free;
+    char *area;     // プールの領域の先頭
+    char *end;      // プールの領域の末尾
 } kzmem_pool;
 
 // メモリプールの定義
-// 3つの固定サイズによる提供
+// 構成はmemconf.hのKZMEM_POOLSで与える
 static kzmem_pool pool[] = {
-        {16, 8, NULL},
-        {32, 8, NULL},
-        {64, 4, NULL},
+#define KZMEM_POOL(size, num) {size, num, NULL, NULL, NULL},
+        KZMEM_POOLS
+#undef KZMEM_POOL
 };
 
 #define MEMORY_AREA_NUM (sizeof(pool) / sizeof(*pool))
 
+// サイズクラスの刻み(各プールのサイズはこの倍数で、小さい順に並べる)
+#define KZMEM_CLASS_SHIFT 4
+#define KZMEM_CLASS_UNIT (1 << KZMEM_CLASS_SHIFT)
+#define KZMEM_POOL_NONE 0xff
+#define KZMEM_POOL_TLSF 0xfe    // TLSFで確保したブロック
+
+#define KZMEM_POOL(size, num) && ((size) <= KZMEM_BLOCK_MAX) && (((size) & (KZMEM_CLASS_UNIT - 1)) == 0)
+#if !(1 KZMEM_POOLS)
+#error "KZMEM_POOLS: block size must be a multiple of 16 and KZMEM_BLOCK_MAX or less"
+#endif
+#undef KZMEM_POOL
+
+// メモリプールの領域の合計
+#define KZMEM_POOL(size, num) + (size) * (num)
+#define KZMEM_AREA_SIZE (0 KZMEM_POOLS)
+
+#if (KZMEM_TLSF_SIZE & 3) || (KZMEM_TLSF_SIZE > 0xfff0)
+#error "KZMEM_TLSF_SIZE must be a multiple of 4 and less than 64KB"
+#endif
+
+// メモリの領域(先頭がTLSFの領域で、その後ろがメモリプールの領域)
+// リンカスクリプトで_freeareaからuserstackまでの間に配置する
+static char kzmem_area[KZMEM_TLSF_SIZE + KZMEM_AREA_SIZE]
+        __attribute__((section(".freearea"), aligned(4)));
+#undef KZMEM_POOL
+
+#if KZMEM_TLSF_SIZE > 0
+// TLSF(Two-Level Segregated Fit)による可変長のメモリ割り当て
+// 空きブロックをサイズの最上位ビット(第1レベル)と、その下の2ビット(第2レベル)で分類したリストで管理し、
+// ビットマップから要求を満たすリストを求めるので、確保も解放も一定時間で済む
+
+#define TLSF_ALIGN_SHIFT 2
+#define TLSF_ALIGN (1 << TLSF_ALIGN_SHIFT)
+#define TLSF_SL_SHIFT 2                                 // 第2レベルの分割数(2のべき)
+#define TLSF_SL_NUM (1 << TLSF_SL_SHIFT)
+#define TLSF_FL_SHIFT (TLSF_SL_SHIFT + TLSF_ALIGN_SHIFT) // これ未満のサイズは第1レベル0にまとめる
+#define TLSF_FL_NUM (16 - TLSF_FL_SHIFT + 1)
+#define TLSF_SMALL_SIZE (1 << TLSF_FL_SHIFT)
+
+#define TLSF_FLAG_FREE 1    // sizeの最下位ビットで空きブロックであることを示す
+
+// TLSFのブロックのヘッダ
+// 末尾にkzmem_blockを含めて領域の直前に置き、kzmem_free()でpoolを見て見分ける
+typedef struct _tlsf_block {
+    struct _tlsf_block *prev_phys;  // アドレス上で直前のブロック
+    uint16 size;                    // ヘッダを除いたサイズと状態のフラグ
+    kzmem_block header;             // poolはKZMEM_POOL_TLSF
+} tlsf_block;
+
+// 空きブロックのリスト(空きブロックの領域の先頭に置く)
+typedef struct {
+    tlsf_block *next;
+    tlsf_block *prev;
+} tlsf_link;
+
+#define TLSF_LINK(b) ((tlsf_link *)((b) + 1))
+#define TLSF_SIZE(b) ((b)->size & ~(TLSF_ALIGN - 1))
+#define TLSF_NEXT(b) ((tlsf_block *)((char *)((b) + 1) + TLSF_SIZE(b)))
+#define TLSF_MIN_SIZE ((int)sizeof(tlsf_link))
+#define TLSF_SIZE_MAX (KZMEM_TLSF_SIZE - 2 * (int)sizeof(tlsf_block))
+
+static uint16 tlsf_flmap;                               // 空きのある第1レベルのビットマップ
+static uint8 tlsf_slmap[TLSF_FL_NUM];                   // 空きのある第2レベルのビットマップ
+static tlsf_block *tlsf_free[TLSF_FL_NUM][TLSF_SL_NUM]; // 空きブロックのリスト
+
+// サイズから第1レベルと第2レベルのインデックスを求める
+static void tlsf_mapping(uint16 size, int *flp, int *slp)
+{
+    int fl;
+
+    if (size < TLSF_SMALL_SIZE) {
+        *flp = 0;
+        *slp = size >> TLSF_ALIGN_SHIFT;
+    } else {
+        fl = fls(size) - 1;
+        *slp = (size >> (fl - TLSF_SL_SHIFT)) & (TLSF_SL_NUM - 1);
+        *flp = fl - TLSF_FL_SHIFT + 1;
+    }
+}
+
+// 空きブロックをリストにつなぐ
+static void tlsf_insert(tlsf_block *b)
+{
+    int fl, sl;
+
+    tlsf_mapping(TLSF_SIZE(b), &fl, &sl);
+    TLSF_LINK(b)->prev = NULL;
+    TLSF_LINK(b)->next = tlsf_free[fl][sl];
+    if (tlsf_free[fl][sl]) {
+        TLSF_LINK(tlsf_free[fl][sl])->prev = b;
+    }
+    tlsf_free[fl][sl] = b;
+    tlsf_slmap[fl] |= 1 << sl;
+    tlsf_flmap |= 1U << fl;
+    b->size |= TLSF_FLAG_FREE;
+}
+
+// 空きブロックをリストから外す
+static void tlsf_remove(tlsf_block *b)
+{
+    int fl, sl;
+    tlsf_link *lp = TLSF_LINK(b);
+
+    tlsf_mapping(TLSF_SIZE(b), &fl, &sl);
+    if (lp->next) {
+        TLSF_LINK(lp->next)->prev = lp->prev;
+    }
+    if (lp->prev) {
+        TLSF_LINK(lp->prev)->next = lp->next;
+    } else {
+        tlsf_free[fl][sl] = lp->next;
+        if (lp->next == NULL) {
+            tlsf_slmap[fl] &= ~(1 << sl);
+            if (!tlsf_slmap[fl]) {
+                tlsf_flmap &= ~(1U << fl);
+            }
+        }
+    }
+    b->size &= ~TLSF_FLAG_FREE;
+}
+
+// 要求サイズ以上であることが保証されるリストから空きブロックを探す
+static tlsf_block *tlsf_find(uint16 size)
+{
+    int fl, sl;
+    uint16 map;
+    tlsf_block *b;
+
+    // 同じ第2レベルのリストには要求より小さいブロックもあるので、次のリストから探すよう切り上げる
+    if (size >= TLSF_SMALL_SIZE) {
+        tlsf_mapping(size + (1 << (fls(size) - 1 - TLSF_SL_SHIFT)) - 1, &fl, &sl);
+    } else {
+        tlsf_mapping(size, &fl, &sl);
+    }
+    map = (fl < TLSF_FL_NUM) ? (tlsf_slmap[fl] & (~0U << sl)) : 0;
+    if (!map) {
+        map = (fl + 1 < TLSF_FL_NUM) ? (tlsf_flmap & (~0U << (fl + 1))) : 0;
+        if (!map) {
+            // 切り上げる前のリストの先頭が足りていればそれを使う
+            tlsf_mapping(size, &fl, &sl);
+            b = tlsf_free[fl][sl];
+            return (b && (TLSF_SIZE(b) >= size)) ? b : NULL;
+        }
+        fl = ffs(map) - 1;
+        map = tlsf_slmap[fl];
+    }
+    sl = ffs(map) - 1;
+    return tlsf_free[fl][sl];
+}
+
+// TLSFの初期化
+// 領域全体を1つの空きブロックとし、末尾に大きさ0の使用中のブロックを番兵として置く
+static void tlsf_init(void)
+{
+    tlsf_block *b = (tlsf_block *)kzmem_area;
+    tlsf_block *sentinel;
+
+    memset(b, 0, sizeof(*b));
+    b->size = TLSF_SIZE_MAX;
+    b->header.pool = KZMEM_POOL_TLSF;
+    sentinel = TLSF_NEXT(b);
+    memset(sentinel, 0, sizeof(*sentinel));
+    sentinel->prev_phys = b;
+    sentinel->header.pool = KZMEM_POOL_TLSF;
+    tlsf_insert(b);
+}
+
+// TLSFによるメモリの確保
+static void *tlsf_alloc(int size)
+{
+    tlsf_block *b, *rest;
+
+    size = (size + TLSF_ALIGN - 1) & ~(TLSF_ALIGN - 1);
+    if (size < TLSF_MIN_SIZE) {
+        size = TLSF_MIN_SIZE;
+    }
+    b = tlsf_find(size);
+    if (b == NULL) {
+        return NULL;
+    }
+    tlsf_remove(b);
+    // 余りが十分大きければ分割して空きブロックに戻す
+    if (TLSF_SIZE(b) >= size + (int)sizeof(tlsf_block) + TLSF_MIN_SIZE) {
+        rest = (tlsf_block *)((char *)(b + 1) + size);
+        rest->prev_phys = b;
+        rest->size = TLSF_SIZE(b) - size - sizeof(tlsf_block);
+        rest->header.pool = KZMEM_POOL_TLSF;
+        TLSF_NEXT(rest)->prev_phys = rest;
+        b->size = size;
+        tlsf_insert(rest);
+    }
+    return b + 1;
+}
+
+// TLSFによるメモリの解放
+// 前後の空きブロックと結合してからリストに戻し、結合後のブロックを返す
+static tlsf_block *tlsf_release(void *mem)
+{
+    tlsf_block *b = (tlsf_block *)mem - 1;
+    tlsf_block *next = TLSF_NEXT(b);
+    tlsf_block *prev = b->prev_phys;
+
+    if (next->size & TLSF_FLAG_FREE) {
+        tlsf_remove(next);
+        b->size += TLSF_SIZE(next) + sizeof(tlsf_block);
+        TLSF_NEXT(b)->prev_phys = b;
+    }
+    if (prev && (prev->size & TLSF_FLAG_FREE)) {
+        tlsf_remove(prev);
+        prev->size += TLSF_SIZE(b) + sizeof(tlsf_block);
+        TLSF_NEXT(prev)->prev_phys = prev;
+        b = prev;
+    }
+    tlsf_insert(b);
+    return b;
+}
+
+// TLSFで確保中のブロックか
+static int tlsf_is_block(tlsf_block *b)
+{
+    char *prev = (char *)b->prev_phys;
+
+    if ((b->header.pool != KZMEM_POOL_TLSF) || (b->size & TLSF_FLAG_FREE) || !TLSF_SIZE(b)) {
+        return 0;
+    }
+    // 直前のブロックから辿れることを確かめる
+    if (prev == NULL) {
+        return ((char *)b == kzmem_area);
+    }
+    if ((prev < kzmem_area) || (prev >= (char *)b)) {
+        return 0;
+    }
+    return (TLSF_NEXT(b->prev_phys) == b);
+}
+#endif
+
+// ヘッダを含めたサイズ(KZMEM_CLASS_UNIT単位)から、使うメモリプールの番号を引く表
+static uint8 sizeclass[(KZMEM_BLOCK_MAX >> KZMEM_CLASS_SHIFT) + 1];
+
 // メモリプールの初期化
-static int kzmem_init_pool(kzmem_pool *p)
+static int kzmem_init_pool(int index)
 {
     int i;
+    kzmem_pool *p = &pool[index];
     kzmem_block *mp;
     kzmem_block **mpp;
-    extern char freearea;   // リンカスクリプトで定義した領域
-    static char *area = &freearea;
+    static char *area = kzmem_area + KZMEM_TLSF_SIZE;
+#ifdef KZMEM_ABSORB_REST
+    extern char userstack;  // リンカスクリプトで定義した領域
+    char *q;
+
+    if (index == MEMORY_AREA_NUM - 1) {
+        // 最後のプールにはuserstackまでの残りをすべて割り当てる
+        p->num = 0;
+        for (q = area; q + p->size <= &userstack; q += p->size) {
+            p->num++;
+        }
+    }
+#endif
 
     mp = (kzmem_block *)area;
+    p->area = area;
 
     // ここの領域をすべて解放済みリンクリストに繋げる
     mpp = &p->free;
     for (i = 0; i < p->num; i++) {
         *mpp = mp;
         memset(mp, 0, sizeof(*mp));
-        mp->size = p->size;
+        mp->pool = KZMEM_POOL_NONE;
         mpp = &(mp->next);
         mp = (kzmem_block *)((char *)mp + p->size);
         area += p->size;
     }
+    p->end = area;
 
     return 0;
 }
@@ -55,39 +312,81 @@ static int kzmem_init_pool(kzmem_pool *p)
 // 動的メモリの初期化
 int kzmem_init(void)
 {
-    int i;
+    int i, j;
     for (i = 0; i < MEMORY_AREA_NUM; i++) {
-        kzmem_init_pool(&pool[i]);
+        kzmem_init_pool(i);
+    }
+#if KZMEM_TLSF_SIZE > 0
+    tlsf_init();
+#endif
+    // サイズごとに、収まる最小のメモリプールを表にしておく
+    for (j = 0, i = 0; j < sizeof(sizeclass); j++) {
+        while ((i < MEMORY_AREA_NUM) && (pool[i].size < (j << KZMEM_CLASS_SHIFT))) {
+            i++;
+        }
+        sizeclass[j] = (i < MEMORY_AREA_NUM) ? i : KZMEM_POOL_NONE;
     }
     return 0;
 }
 
+// 要求サイズを格納できるメモリプールの番号を返す(無ければ-1)
+// メモリプールに収まらずTLSFで確保するサイズならKZMEM_POOL_TLSFを返す
+int kzmem_class(int size)
+{
+    int i;
+
+    if (size < 0) {
+        return -1;
+    }
+    if (size > KZMEM_BLOCK_MAX - (int)sizeof(kzmem_block)) {
+#if KZMEM_TLSF_SIZE > 0
+        if (size <= TLSF_SIZE_MAX) {
+            return KZMEM_POOL_TLSF;
+        }
+#endif
+        return -1;
+    }
+    i = sizeclass[(size + (int)sizeof(kzmem_block) + KZMEM_CLASS_UNIT - 1) >> KZMEM_CLASS_SHIFT];
+    return (i == KZMEM_POOL_NONE) ? -1 : i;
+}
+
 // 動的メモリの確保
-void *kzmem_alloc(int size)
+// ownerは確保したスレッドとしてヘッダに記録する
+// 確保できなければNULLを返す
+void *kzmem_alloc(int size, int owner)
 {
     kzmem_block *mp;
     kzmem_pool *p;
     int i;
 
-    // 要求サイズを格納できるメモリプールを探す
-    for (i = 0; i < MEMORY_AREA_NUM; i++) {
-        p = &pool[i];
-        if (size <= p->size - sizeof(kzmem_block)) {
-            if (p->free == NULL) {
-                // 空きがないのでダウン
-                kz_sysdown();
-                return NULL;
-            }
-            // 空いている領域を取得
-            mp = p->free;
-            p->free = p->free->next;
-            mp->next = NULL;
-            // 先頭には管理用ヘッダのメモリブロック構造体があるので+1をして返す
-            return mp + 1;
+    // 要求サイズを格納できるメモリプールを表から求める
+    i = kzmem_class(size);
+    if (i < 0) {
+        return NULL;
+    }
+#if KZMEM_TLSF_SIZE > 0
+    if (i == KZMEM_POOL_TLSF) {
+        mp = tlsf_alloc(size);
+        if (mp == NULL) {
+            return NULL;
         }
+        mp[-1].owner = owner;
+        return mp;
     }
-    kz_sysdown();
-    return NULL;
+#endif
+    p = &pool[i];
+    if (p->free == NULL) {
+        // 空きがない
+        return NULL;
+    }
+    // 空いている領域を取得
+    mp = p->free;
+    p->free = p->free->next;
+    mp->next = NULL;
+    mp->owner = owner;
+    mp->pool = i;
+    // 先頭には管理用ヘッダのメモリブロック構造体があるので+1をして返す
+    return mp + 1;
 }
 
 // メモリを解放
@@ -100,15 +399,103 @@ void kzmem_free(void *mem)
     // 領域の前にあるヘッダを取得
     mp = ((kzmem_block *)mem -1);
 
+    // ヘッダに記録したメモリプールに戻す
+    i = mp->pool;
+#if KZMEM_TLSF_SIZE > 0
+    if (i == KZMEM_POOL_TLSF) {
+        tlsf_release(mem);
+        return;
+    }
+#endif
+    if (i >= MEMORY_AREA_NUM) {
+        // 解放済みのブロックや不正なアドレス
+        kz_sysdown();
+        return;
+    }
+    p = &pool[i];
+    // 解放済みリストに戻す
+    mp->owner = 0;
+    mp->pool = KZMEM_POOL_NONE;
+    mp->next = p->free;
+    p->free = mp;
+}
+
+// 確保中のブロックを確保したスレッドを返す
+// memが確保中のブロックでなければ-1を返す
+int kzmem_owner(void *mem)
+{
+    kzmem_block *mp = (kzmem_block *)mem - 1;
+    kzmem_pool *p;
+    char *c = (char *)mp;
+
+    if ((c < kzmem_area) || (mem == NULL)) {
+        return -1;
+    }
+#if KZMEM_TLSF_SIZE > 0
+    if (c < kzmem_area + KZMEM_TLSF_SIZE) {
+        return tlsf_is_block((tlsf_block *)mem - 1) ? mp->owner : -1;
+    }
+#endif
+    if (mp->pool >= MEMORY_AREA_NUM) {
+        return -1;
+    }
+    // プールの領域内で、ブロックの境界にあるかを確かめる
+    p = &pool[mp->pool];
+    if ((c < p->area) || (c >= p->end) || ((uint16)(c - p->area) % p->size)) {
+        return -1;
+    }
+    return mp->owner;
+}
+
+// 確保中のブロックのサイズ(ヘッダを含む)を返す
+int kzmem_size(void *mem)
+{
+    kzmem_block *mp = (kzmem_block *)mem - 1;
+
+#if KZMEM_TLSF_SIZE > 0
+    if (mp->pool == KZMEM_POOL_TLSF) {
+        return TLSF_SIZE((tlsf_block *)mem - 1) + sizeof(tlsf_block);
+    }
+#endif
+    return pool[mp->pool].size;
+}
+
+// 確保中のブロックの所有者を変える
+void kzmem_chown(void *mem, int owner)
+{
+    ((kzmem_block *)mem - 1)->owner = owner;
+}
+
+// ownerが確保中のブロックをすべて解放する
+// reclaimが偽なら解放せずに所有者を外すだけにする
+void kzmem_reclaim(int owner, int reclaim)
+{
+    kzmem_pool *p;
+    kzmem_block *mp;
+    int i;
+#if KZMEM_TLSF_SIZE > 0
+    tlsf_block *b;
+
+    for (b = (tlsf_block *)kzmem_area; TLSF_SIZE(b); b = TLSF_NEXT(b)) {
+        if (!(b->size & TLSF_FLAG_FREE) && (b->header.owner == owner)) {
+            b->header.owner = 0;
+            if (reclaim) {
+                // 前後と結合するので、結合後のブロックから続ける
+                b = tlsf_release(b + 1);
+            }
+        }
+    }
+#endif
     for (i = 0; i < MEMORY_AREA_NUM; i++) {
         p = &pool[i];
-        // 同じサイズのメモリプールを検索
-        if (mp->size == p->size) {
-            // 解放済みリストに戻す
-            mp->next = p->free;
-            p->free = mp;
-            return;
+        for (mp = (kzmem_block *)p->area; (char *)mp < p->end; mp = (kzmem_block *)((char *)mp + p->size)) {
+            if ((mp->pool == i) && (mp->owner == owner)) {
+                if (reclaim) {
+                    kzmem_free(mp + 1);
+                } else {
+                    mp->owner = 0;
+                }
+            }
         }
     }
-    kz_sysdown();
 }
@@ -1,8 +1,13 @@
 #ifndef _KOZOS_MEMORY_H_INCLUDED_
 #define _KOZOS_MEMORY_H_INCLUDED_
 
-int kzmem_init(void);           // 動的メモリの初期化
-void *kzmem_alloc(int size);    // メモリの獲得
-void kzmem_free(void *mem);     // メモリの解放
+int kzmem_init(void);                       // 動的メモリの初期化
+int kzmem_class(int size);                  // 要求サイズに使うメモリプールの番号
+void *kzmem_alloc(int size, int owner);     // メモリの獲得
+void kzmem_free(void *mem);                 // メモリの解放
+int kzmem_owner(void *mem);                 // 確保したスレッド
+int kzmem_size(void *mem);                  // ブロックのサイズ
+void kzmem_chown(void *mem, int owner);     // 所有者の変更
+void kzmem_reclaim(int owner, int reclaim); // スレッドが確保したメモリの回収
 
 #endif
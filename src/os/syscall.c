@@ -33,10 +33,27 @@ int kz_wait(void)
 int kz_sleep(void)
 {
     kz_syscall_param_t param;
+    param.un.sleep.timeout = KZ_TIMEOUT_FOREVER;
     kz_syscall(KZ_SYSCALL_TYPE_SLEEP, &param);
     return param.un.sleep.ret;
 }
 
+int kz_tsleep(int timeout)
+{
+    kz_syscall_param_t param;
+    param.un.sleep.timeout = timeout;
+    kz_syscall(KZ_SYSCALL_TYPE_SLEEP, &param);
+    return param.un.sleep.ret;
+}
+
+int kz_delay(int ticks)
+{
+    kz_syscall_param_t param;
+    param.un.delay.ticks = ticks;
+    kz_syscall(KZ_SYSCALL_TYPE_DELAY, &param);
+    return param.un.delay.ret;
+}
+
 int kz_wakeup(kz_thread_id_t id)
 {
     kz_syscall_param_t param;
@@ -68,6 +85,14 @@ void *kz_kmalloc(int size)
     return param.un.kmalloc.ret;
 }
 
+void *kz_kmalloc_wait(int size)
+{
+    kz_syscall_param_t param;
+    param.un.kmalloc.size = size;
+    kz_syscall(KZ_SYSCALL_TYPE_KMALLOC_WAIT, &param);
+    return param.un.kmalloc.ret;
+}
+
 int kz_kmfree(void *p)
 {
     kz_syscall_param_t param;
@@ -86,16 +111,123 @@ int kz_send(kz_msgbox_id_t id, int size, char *p)
     return param.un.send.ret;
 }
 
+int kz_sendi(kz_msgbox_id_t id, int size, char *p)
+{
+    kz_syscall_param_t param;
+    param.un.send.id = id;
+    param.un.send.size = size;
+    param.un.send.p = p;
+    kz_syscall(KZ_SYSCALL_TYPE_SENDI, &param);
+    return param.un.send.ret;
+}
+
+#ifdef KZ_MSG_SENDV
+int kz_sendv(kz_msgvec_t *vec, int num)
+{
+    kz_syscall_param_t param;
+    param.un.sendv.vec = vec;
+    param.un.sendv.num = num;
+    kz_syscall(KZ_SYSCALL_TYPE_SENDV, &param);
+    return param.un.sendv.ret;
+}
+#endif
+
 kz_thread_id_t kz_recv(kz_msgbox_id_t id, int *sizep, char **pp)
 {
     kz_syscall_param_t param;
     param.un.recv.id = id;
     param.un.recv.sizep = sizep;
     param.un.recv.pp = pp;
+    param.un.recv.buf = NULL;
+    param.un.recv.timeout = KZ_TIMEOUT_FOREVER;
+    kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
+    return param.un.recv.ret;
+}
+
+kz_thread_id_t kz_recvbuf(kz_msgbox_id_t id, int *sizep, char **pp, char *buf)
+{
+    kz_syscall_param_t param;
+    param.un.recv.id = id;
+    param.un.recv.sizep = sizep;
+    param.un.recv.pp = pp;
+    param.un.recv.buf = buf;
+    param.un.recv.timeout = KZ_TIMEOUT_FOREVER;
     kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
     return param.un.recv.ret;
 }
 
+kz_thread_id_t kz_tryrecv(kz_msgbox_id_t id, int *sizep, char **pp)
+{
+    return kz_recv_timeout(id, 0, sizep, pp);
+}
+
+kz_thread_id_t kz_recv_timeout(kz_msgbox_id_t id, int timeout, int *sizep, char **pp)
+{
+    kz_syscall_param_t param;
+    param.un.recv.id = id;
+    param.un.recv.sizep = sizep;
+    param.un.recv.pp = pp;
+    param.un.recv.buf = NULL;
+    param.un.recv.timeout = timeout;
+    kz_syscall(KZ_SYSCALL_TYPE_RECV, &param);
+    return param.un.recv.ret;
+}
+
+#ifdef KZ_MSG_SELECT
+kz_thread_id_t kz_select(uint32 mask, kz_msgbox_id_t *idp, int *sizep, char **pp)
+{
+    kz_syscall_param_t param;
+    param.un.select.mask = mask;
+    param.un.select.idp = idp;
+    param.un.select.sizep = sizep;
+    param.un.select.pp = pp;
+    kz_syscall(KZ_SYSCALL_TYPE_SELECT, &param);
+    return param.un.select.ret;
+}
+#endif
+
+#ifdef KZ_MSG_CALL
+int kz_call(kz_msgbox_id_t id, int size, char *p, int *rsizep, char **rpp)
+{
+    kz_syscall_param_t param;
+    param.un.call.id = id;
+    param.un.call.size = size;
+    param.un.call.p = p;
+    param.un.call.rsizep = rsizep;
+    param.un.call.rpp = rpp;
+    kz_syscall(KZ_SYSCALL_TYPE_CALL, &param);
+    return param.un.call.ret;
+}
+
+int kz_reply(kz_thread_id_t id, int size, char *p)
+{
+    kz_syscall_param_t param;
+    param.un.reply.id = id;
+    param.un.reply.size = size;
+    param.un.reply.p = p;
+    kz_syscall(KZ_SYSCALL_TYPE_REPLY, &param);
+    return param.un.reply.ret;
+}
+#endif
+
+#ifdef KZ_MBOX_NAMED
+kz_msgbox_id_t kz_mbox_create(char *name)
+{
+    kz_syscall_param_t param;
+    param.un.mbox_create.name = name;
+    kz_syscall(KZ_SYSCALL_TYPE_MBOX_CREATE, &param);
+    return param.un.mbox_create.ret;
+}
+
+kz_msgbox_id_t kz_mbox_lookup(char *name)
+{
+    kz_syscall_param_t param;
+    param.un.mbox_lookup.name = name;
+    kz_syscall(KZ_SYSCALL_TYPE_MBOX_LOOKUP, &param);
+    return param.un.mbox_lookup.ret;
+}
+#endif
+
 int kz_setintr(softvec_type_t type, kz_handler_t handler)
 {
     kz_syscall_param_t param;
@@ -105,6 +237,123 @@ int kz_setintr(softvec_type_t type, kz_handler_t handler)
     return param.un.setintr.ret;
 }
 
+int kz_setslice(int priority, int ticks)
+{
+    kz_syscall_param_t param;
+    param.un.setslice.priority = priority;
+    param.un.setslice.ticks = ticks;
+    kz_syscall(KZ_SYSCALL_TYPE_SETSLICE, &param);
+    return param.un.setslice.ret;
+}
+
+#ifdef KZ_MUTEX
+kz_mutex_id_t kz_mutex_create(void)
+{
+    kz_syscall_param_t param;
+    kz_syscall(KZ_SYSCALL_TYPE_MUTEX_CREATE, &param);
+    return param.un.mutex_create.ret;
+}
+
+int kz_mutex_lock(kz_mutex_id_t id)
+{
+    kz_syscall_param_t param;
+    param.un.mutex_lock.id = id;
+    kz_syscall(KZ_SYSCALL_TYPE_MUTEX_LOCK, &param);
+    return param.un.mutex_lock.ret;
+}
+
+int kz_mutex_unlock(kz_mutex_id_t id)
+{
+    kz_syscall_param_t param;
+    param.un.mutex_unlock.id = id;
+    kz_syscall(KZ_SYSCALL_TYPE_MUTEX_UNLOCK, &param);
+    return param.un.mutex_unlock.ret;
+}
+#endif
+
+#ifdef KZ_SEMFLAG
+kz_sem_id_t kz_sem_create(int count)
+{
+    kz_syscall_param_t param;
+    param.un.sem_create.count = count;
+    kz_syscall(KZ_SYSCALL_TYPE_SEM_CREATE, &param);
+    return param.un.sem_create.ret;
+}
+
+int kz_sem_wait(kz_sem_id_t id)
+{
+    kz_syscall_param_t param;
+    param.un.sem_wait.id = id;
+    kz_syscall(KZ_SYSCALL_TYPE_SEM_WAIT, &param);
+    return param.un.sem_wait.ret;
+}
+
+int kz_sem_post(kz_sem_id_t id)
+{
+    kz_syscall_param_t param;
+    param.un.sem_post.id = id;
+    kz_syscall(KZ_SYSCALL_TYPE_SEM_POST, &param);
+    return param.un.sem_post.ret;
+}
+
+kz_flag_id_t kz_flag_create(void)
+{
+    kz_syscall_param_t param;
+    kz_syscall(KZ_SYSCALL_TYPE_FLAG_CREATE, &param);
+    return param.un.flag_create.ret;
+}
+
+int kz_flag_wait(kz_flag_id_t id, uint16 pattern, int mode, uint16 *ptnp)
+{
+    kz_syscall_param_t param;
+    param.un.flag_wait.id = id;
+    param.un.flag_wait.pattern = pattern;
+    param.un.flag_wait.mode = mode;
+    param.un.flag_wait.ptnp = ptnp;
+    kz_syscall(KZ_SYSCALL_TYPE_FLAG_WAIT, &param);
+    return param.un.flag_wait.ret;
+}
+
+int kz_flag_set(kz_flag_id_t id, uint16 pattern)
+{
+    kz_syscall_param_t param;
+    param.un.flag_set.id = id;
+    param.un.flag_set.pattern = pattern;
+    kz_syscall(KZ_SYSCALL_TYPE_FLAG_SET, &param);
+    return param.un.flag_set.ret;
+}
+
+int kz_flag_clear(kz_flag_id_t id, uint16 pattern)
+{
+    kz_syscall_param_t param;
+    param.un.flag_clear.id = id;
+    param.un.flag_clear.pattern = pattern;
+    kz_syscall(KZ_SYSCALL_TYPE_FLAG_CLEAR, &param);
+    return param.un.flag_clear.ret;
+}
+#endif
+
+#ifdef KZ_STACK_WATERMARK
+int kz_stackfree(kz_thread_id_t id)
+{
+    kz_syscall_param_t param;
+    param.un.stackfree.id = id;
+    kz_syscall(KZ_SYSCALL_TYPE_STACKFREE, &param);
+    return param.un.stackfree.ret;
+}
+#endif
+
+#ifdef KZ_THREAD_STAT
+int kz_getstat(kz_thread_id_t id, kz_thread_stat_t *stat)
+{
+    kz_syscall_param_t param;
+    param.un.getstat.id = id;
+    param.un.getstat.stat = stat;
+    kz_syscall(KZ_SYSCALL_TYPE_GETSTAT, &param);
+    return param.un.getstat.ret;
+}
+#endif
+
 int kx_wakeup(kz_thread_id_t id)
 {
     kz_syscall_param_t param;
@@ -139,3 +388,31 @@ int kx_send(kz_msgbox_id_t id, int size, char *p)
     return param.un.send.ret;
 }
 
+int kx_sendi(kz_msgbox_id_t id, int size, char *p)
+{
+    kz_syscall_param_t param;
+    param.un.send.id = id;
+    param.un.send.size = size;
+    param.un.send.p = p;
+    kz_srvcall(KZ_SYSCALL_TYPE_SENDI, &param);
+    return param.un.send.ret;
+}
+
+#ifdef KZ_SEMFLAG
+int kx_sem_post(kz_sem_id_t id)
+{
+    kz_syscall_param_t param;
+    param.un.sem_post.id = id;
+    kz_srvcall(KZ_SYSCALL_TYPE_SEM_POST, &param);
+    return param.un.sem_post.ret;
+}
+
+int kx_flag_set(kz_flag_id_t id, uint16 pattern)
+{
+    kz_syscall_param_t param;
+    param.un.flag_set.id = id;
+    param.un.flag_set.pattern = pattern;
+    kz_srvcall(KZ_SYSCALL_TYPE_FLAG_SET, &param);
+    return param.un.flag_set.ret;
+}
+#endif
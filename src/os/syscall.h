@@ -18,6 +18,28 @@ typedef enum {
     KZ_SYSCALL_TYPE_SEND,
     KZ_SYSCALL_TYPE_RECV,
     KZ_SYSCALL_TYPE_SETINTR,
+    KZ_SYSCALL_TYPE_SETSLICE,
+    KZ_SYSCALL_TYPE_DELAY,
+    KZ_SYSCALL_TYPE_MUTEX_CREATE,
+    KZ_SYSCALL_TYPE_MUTEX_LOCK,
+    KZ_SYSCALL_TYPE_MUTEX_UNLOCK,
+    KZ_SYSCALL_TYPE_SEM_CREATE,
+    KZ_SYSCALL_TYPE_SEM_WAIT,
+    KZ_SYSCALL_TYPE_SEM_POST,
+    KZ_SYSCALL_TYPE_FLAG_CREATE,
+    KZ_SYSCALL_TYPE_FLAG_WAIT,
+    KZ_SYSCALL_TYPE_FLAG_SET,
+    KZ_SYSCALL_TYPE_FLAG_CLEAR,
+    KZ_SYSCALL_TYPE_STACKFREE,
+    KZ_SYSCALL_TYPE_GETSTAT,
+    KZ_SYSCALL_TYPE_SELECT,
+    KZ_SYSCALL_TYPE_CALL,
+    KZ_SYSCALL_TYPE_REPLY,
+    KZ_SYSCALL_TYPE_MBOX_CREATE,
+    KZ_SYSCALL_TYPE_MBOX_LOOKUP,
+    KZ_SYSCALL_TYPE_SENDI,
+    KZ_SYSCALL_TYPE_SENDV,
+    KZ_SYSCALL_TYPE_KMALLOC_WAIT,
 } kz_syscall_type_t;
 
 // システムコール呼び出し時のパラメータ格納用構造体
@@ -39,6 +61,7 @@ typedef struct {
             int ret;
         } wait;
         struct {
+            int timeout;
             int ret;
         } sleep;
         struct {
@@ -70,6 +93,8 @@ typedef struct {
             kz_msgbox_id_t id;
             int *sizep;
             char **pp;
+            char *buf;
+            int timeout;
             kz_thread_id_t ret;
         } recv;
         struct {
@@ -77,6 +102,101 @@ typedef struct {
             kz_handler_t handler;
             int ret;
         } setintr;
+        struct {
+            int priority;
+            int ticks;
+            int ret;
+        } setslice;
+        struct {
+            int ticks;
+            int ret;
+        } delay;
+        struct {
+            kz_mutex_id_t ret;
+        } mutex_create;
+        struct {
+            kz_mutex_id_t id;
+            int ret;
+        } mutex_lock;
+        struct {
+            kz_mutex_id_t id;
+            int ret;
+        } mutex_unlock;
+        struct {
+            int count;
+            kz_sem_id_t ret;
+        } sem_create;
+        struct {
+            kz_sem_id_t id;
+            int ret;
+        } sem_wait;
+        struct {
+            kz_sem_id_t id;
+            int ret;
+        } sem_post;
+        struct {
+            kz_flag_id_t ret;
+        } flag_create;
+        struct {
+            kz_flag_id_t id;
+            uint16 pattern;
+            int mode;
+            uint16 *ptnp;
+            int ret;
+        } flag_wait;
+        struct {
+            kz_flag_id_t id;
+            uint16 pattern;
+            int ret;
+        } flag_set;
+        struct {
+            kz_flag_id_t id;
+            uint16 pattern;
+            int ret;
+        } flag_clear;
+        struct {
+            kz_thread_id_t id;
+            int ret;
+        } stackfree;
+        struct {
+            kz_thread_id_t id;
+            kz_thread_stat_t *stat;
+            int ret;
+        } getstat;
+        struct {
+            uint32 mask;
+            kz_msgbox_id_t *idp;
+            int *sizep;
+            char **pp;
+            kz_thread_id_t ret;
+        } select;
+        struct {
+            kz_msgbox_id_t id;
+            int size;
+            char *p;
+            int *rsizep;
+            char **rpp;
+            int ret;
+        } call;
+        struct {
+            kz_thread_id_t id;
+            int size;
+            char *p;
+            int ret;
+        } reply;
+        struct {
+            char *name;
+            kz_msgbox_id_t ret;
+        } mbox_create;
+        struct {
+            char *name;
+            kz_msgbox_id_t ret;
+        } mbox_lookup;
+        struct {
+            kz_msgvec_t *vec;
+            int num;
+            int ret;
+        } sendv;
     } un;
 } kz_syscall_param_t;
 
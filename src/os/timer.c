@@ -0,0 +1,132 @@
+#include "defines.h"
+#include "timer.h"
+
+// 16ビットタイマのチャネル数
+#define TIMER_NUM 3
+// 16ビットタイマの定義
+#define H8_3069F_TMR16   ((volatile struct h8_3069f_tmr16 *)0xffff60)
+#define H8_3069F_TMR16_0 ((volatile struct h8_3069f_tmr16_ch *)0xffff68)
+#define H8_3069F_TMR16_1 ((volatile struct h8_3069f_tmr16_ch *)0xffff70)
+#define H8_3069F_TMR16_2 ((volatile struct h8_3069f_tmr16_ch *)0xffff78)
+
+// 16ビットタイマの全チャネル共通レジスタ定義
+struct h8_3069f_tmr16 {
+    volatile uint8 tstr;
+    volatile uint8 tsnc;
+    volatile uint8 tmdr;
+    volatile uint8 tolr;
+    volatile uint8 tisra;
+    volatile uint8 tisrb;
+    volatile uint8 tisrc;
+};
+
+// 16ビットタイマの各チャネルのレジスタ定義
+struct h8_3069f_tmr16_ch {
+    volatile uint8 tcr;
+    volatile uint8 tior;
+    volatile uint16 tcnt;
+    volatile uint16 gra;
+    volatile uint16 grb;
+};
+
+// TSTRの各ビットの定義
+#define H8_3069F_TMR16_TSTR_STR(n)      (1<<(n))    // カウント動作
+
+// TISRAの各ビットの定義
+#define H8_3069F_TMR16_TISRA_IMFA(n)    (1<<(n))        // GRAコンペアマッチ
+#define H8_3069F_TMR16_TISRA_IMIEA(n)   (1<<((n)+4))    // GRAコンペアマッチ割り込み許可
+
+// TCRの各ビットの定義
+#define H8_3069F_TMR16_TCR_TPSC_PER1    (0<<0)
+#define H8_3069F_TMR16_TCR_TPSC_PER2    (1<<0)
+#define H8_3069F_TMR16_TCR_TPSC_PER4    (2<<0)
+#define H8_3069F_TMR16_TCR_TPSC_PER8    (3<<0)
+#define H8_3069F_TMR16_TCR_CCLR_DISABLE (0<<5)
+#define H8_3069F_TMR16_TCR_CCLR_GRA     (1<<5)      // GRAのコンペアマッチでクリア
+#define H8_3069F_TMR16_TCR_CCLR_GRB     (2<<5)
+
+static struct {
+    volatile struct h8_3069f_tmr16_ch *tmr;
+} regs[TIMER_NUM] = {
+        {H8_3069F_TMR16_0},
+        {H8_3069F_TMR16_1},
+        {H8_3069F_TMR16_2},
+};
+
+// デバイス初期化
+int timer_init(int index)
+{
+    volatile struct h8_3069f_tmr16_ch *tmr = regs[index].tmr;
+
+    timer_stop(index);
+    // GRAのコンペアマッチでカウンタをクリアし、φ/8でカウントする
+    tmr->tcr = H8_3069F_TMR16_TCR_CCLR_GRA | H8_3069F_TMR16_TCR_TPSC_PER8;
+    tmr->tior = 0;
+    tmr->tcnt = 0;
+
+    return 0;
+}
+
+// countカウントの周期でタイマを開始する
+int timer_start(int index, uint16 count)
+{
+    volatile struct h8_3069f_tmr16_ch *tmr = regs[index].tmr;
+
+    if (count == 0) {
+        return -1;
+    }
+    tmr->gra = count - 1;
+    tmr->tcnt = 0;
+    timer_expire(index);
+    // コンペアマッチ割り込みを有効化してカウント開始
+    H8_3069F_TMR16->tisra |= H8_3069F_TMR16_TISRA_IMIEA(index);
+    H8_3069F_TMR16->tstr |= H8_3069F_TMR16_TSTR_STR(index);
+
+    return 0;
+}
+
+// タイマを停止する
+void timer_stop(int index)
+{
+    H8_3069F_TMR16->tstr &= ~H8_3069F_TMR16_TSTR_STR(index);
+    H8_3069F_TMR16->tisra &= ~H8_3069F_TMR16_TISRA_IMIEA(index);
+}
+
+// 動作中のタイマの周期を変更する
+void timer_setperiod(int index, uint16 count)
+{
+    regs[index].tmr->gra = count - 1;
+}
+
+// カウント値を設定する
+void timer_settime(int index, uint16 count)
+{
+    regs[index].tmr->tcnt = count;
+}
+
+// タイマが動作中か?
+int timer_is_running(int index)
+{
+    return (H8_3069F_TMR16->tstr & H8_3069F_TMR16_TSTR_STR(index)) ? 1 : 0;
+}
+
+// 周期が満了したか?
+int timer_is_expired(int index)
+{
+    return (H8_3069F_TMR16->tisra & H8_3069F_TMR16_TISRA_IMFA(index)) ? 1 : 0;
+}
+
+// 満了フラグを落とす
+void timer_expire(int index)
+{
+    // フラグは1を読み出した後に0を書き込むことでクリアされる
+    if (H8_3069F_TMR16->tisra & H8_3069F_TMR16_TISRA_IMFA(index)) {
+        H8_3069F_TMR16->tisra &= ~H8_3069F_TMR16_TISRA_IMFA(index);
+    }
+}
+
+// 現在のカウント値を取得する
+uint16 timer_gettime(int index)
+{
+    return regs[index].tmr->tcnt;
+}
@@ -0,0 +1,17 @@
+#ifndef _TIMER_H_INCLUDED_
+#define _TIMER_H_INCLUDED_
+
+// 1ミリ秒あたりのカウント数(システムクロック20MHz、φ/8で動作)
+#define TIMER_COUNT_PER_MSEC 2500
+
+int timer_init(int index);
+int timer_start(int index, uint16 count);
+void timer_stop(int index);
+void timer_setperiod(int index, uint16 count);
+void timer_settime(int index, uint16 count);
+int timer_is_running(int index);
+int timer_is_expired(int index);
+void timer_expire(int index);
+uint16 timer_gettime(int index);
+
+#endif